@@ -1,5 +1,14 @@
 from .slangtorch import (
     loadModule,
+    loadModuleAsync,
+    loadModules,
+    loadModuleVariants,
+    autotune,
     clearPersistentShaderCache,
     clearSessionShaderCache,
-    clearShaderCaches)
\ No newline at end of file
+    clearShaderCaches,
+    getCacheStats,
+    collectStaleBuildDirs,
+    buildPrebuiltModules,
+    loadPrebuiltModule,
+    warmupModules)
\ No newline at end of file
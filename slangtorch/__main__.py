@@ -0,0 +1,90 @@
+#
+# Command-line interface.
+#
+#   python -m slangtorch build multiply.slang -D FACTOR=2.0 -o prebuilt/
+#
+# builds Slang modules ahead of time into a directory that can be loaded with
+# slangtorch.loadPrebuiltModule() on machines without slangc, nvcc or a host compiler.
+#
+#   SLANGTORCH_RECORD_MANIFEST=warmup.json python train.py
+#   python -m slangtorch warmup warmup.json
+#
+# records the modules loaded by a program, and builds all of them into the cache (e.g. when
+# building an image). Exits with a non-zero status if any module fails to build.
+#
+
+import argparse
+import sys
+
+
+def _parseDefines(defines):
+    result = {}
+    for define in defines or []:
+        name, _, value = define.partition('=')
+        result[name] = value
+    return result
+
+
+def buildCommand(args):
+    from .slangtorch import buildPrebuiltModules
+
+    manifest = buildPrebuiltModules(
+        args.files,
+        args.output,
+        defines=_parseDefines(args.define),
+        includePaths=args.include or [],
+        verbose=args.verbose,
+        slangGenLineInfo=not args.no_slang_line_info,
+        cudaFastMath=not args.no_fast_math,
+        cudaGenLineInfo=not args.no_cuda_line_info,
+        extraSlangFlags=args.extra_slang_flag or [],
+        extraCudaFlags=args.extra_cuda_flag or [])
+
+    print(f"Wrote {len(manifest['modules'])} module(s) to {args.output}")
+    return 0
+
+
+def warmupCommand(args):
+    import os
+    if args.jobs:
+        os.environ['MAX_JOBS'] = str(args.jobs)
+
+    from .slangtorch import readWarmupManifest, warmupModules
+
+    moduleCount = len(readWarmupManifest(args.manifest))
+    failures = warmupModules(args.manifest, globalCacheDir=args.global_cache_dir, verbose=args.verbose)
+
+    print(f"Built {moduleCount - len(failures)} of {moduleCount} module(s)")
+    return 1 if failures else 0
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(prog="python -m slangtorch")
+    subparsers = parser.add_subparsers(dest="command", required=True)
+
+    build = subparsers.add_parser("build", help="Build Slang modules into a prebuilt package")
+    build.add_argument("files", nargs="+", help="Slang source files")
+    build.add_argument("-o", "--output", required=True, help="Output directory (created if missing)")
+    build.add_argument("-D", "--define", action="append", metavar="NAME=VALUE", help="Preprocessor define")
+    build.add_argument("-I", "--include", action="append", metavar="PATH", help="Include path")
+    build.add_argument("--extra-slang-flag", action="append", metavar="FLAG", help="Extra flag passed to slangc")
+    build.add_argument("--extra-cuda-flag", action="append", metavar="FLAG", help="Extra flag passed to nvcc")
+    build.add_argument("--no-fast-math", action="store_true", help="Don't compile with --use_fast_math")
+    build.add_argument("--no-cuda-line-info", action="store_true", help="Don't compile with --generate-line-info")
+    build.add_argument("--no-slang-line-info", action="store_true", help="Don't emit #line directives")
+    build.add_argument("-v", "--verbose", action="store_true")
+    build.set_defaults(func=buildCommand)
+
+    warmup = subparsers.add_parser("warmup", help="Build every module listed in a warm-up manifest into the cache")
+    warmup.add_argument("manifest", help="Manifest file (e.g. recorded with SLANGTORCH_RECORD_MANIFEST)")
+    warmup.add_argument("--global-cache-dir", help="Also store the builds in this global cache")
+    warmup.add_argument("-j", "--jobs", type=int, help="Maximum number of concurrent compiler jobs")
+    warmup.add_argument("-v", "--verbose", action="store_true")
+    warmup.set_defaults(func=warmupCommand)
+
+    args = parser.parse_args(argv)
+    return args.func(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
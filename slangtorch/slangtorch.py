@@ -6,11 +6,29 @@ import hashlib
 import json
 import re
 import time
+import threading
+import concurrent.futures
+import shutil
+import uuid
+import atexit
 from importlib.metadata import version
 from filelock import FileLock
 
-from .util import jit_compile, run_ninja, NinjaResult
+try:
+    import fcntl
+except ImportError:
+    fcntl = None
+
+from .util import jit_compile, run_ninja, collect_ninja_deps, NinjaResult, getJobBudget, trimObjectCache
+from .util import splitModuleDefinition, isModuleDefinitionFile
 from .util import wrapModule
+from .util import SlangLibraryCompiler
+from .util import GlobalBuildCache
+from .util import cloneBuildDir, copyFile
+from .util import getPrecompiledPreludeSources, isPrecompiledPreludeFile
+from .util import FileWatcher
+from .util import BuildLock
+from .util import mergeVariantSources, VARIANT_SUBMODULE
 
 packageDir = os.path.dirname(__file__)
 versionCode = version('slangtorch')
@@ -44,8 +62,18 @@ if 'SLANGC_PATH' in os.environ:
 # Ensure that slangcPath is a proper path
 slangcPath = os.path.realpath(slangcPath)
 
-if not os.path.exists(slangcPath):
-    raise RuntimeError(f"Could not find slangc executable at {slangcPath}")
+# slangc is only needed to compile modules. Prebuilt modules can be loaded without it.
+slangcAvailable = os.path.exists(slangcPath)
+
+# Slang compile backend. 'slangc' spawns the slangc executable for every compile, 'library' loads 
+# the Slang shared library once per process and compiles in-process (falls back to 'slangc' if the
+# library can't be loaded).
+#
+slangCompileBackend = os.environ.get('SLANGTORCH_SLANG_BACKEND', 'slangc')
+
+_slangLibraryCompiler = None
+_slangLibraryCompilerFailed = False
+_slangLibraryCompilerLock = threading.Lock()
 
 # Mapping from module key to latest version number. Used to create unique build directories.
 MODULE_VERSIONS = {}
@@ -55,31 +83,107 @@ MODULE_VERSIONS = {}
 #
 LOADED_BUILD_DIRS = {}
 
+# Open lock files of build directories loaded by this process. Each one holds a shared lock for the
+# lifetime of the process, so that other processes can tell the directory is in use.
+#
+BUILD_DIR_HOLDS = {}
+
+# Number of loadModule calls that were served from an existing build without
+# running slangc or ninja (hits), and the number that had to go through the build path (misses).
+#
+CACHE_STATS = {"hits": 0, "misses": 0}
+
+# Guards the session state above. Modules can be loaded from several threads (loadModuleAsync);
+# loads of the same module are serialized by its FileLock, but share these tables.
+#
+_sessionLock = threading.RLock()
+
 def getUniqueSessionVersion(moduleKey):
-    if moduleKey not in MODULE_VERSIONS:
-        MODULE_VERSIONS[moduleKey] = 0
-    else:
-        MODULE_VERSIONS[moduleKey] += 1
-    
-    return MODULE_VERSIONS[moduleKey]
+    with _sessionLock:
+        if moduleKey not in MODULE_VERSIONS:
+            MODULE_VERSIONS[moduleKey] = 0
+        else:
+            MODULE_VERSIONS[moduleKey] += 1
+        
+        return MODULE_VERSIONS[moduleKey]
 
 def getCurrentSessionVersion(moduleKey):
-    if moduleKey not in MODULE_VERSIONS:
-        MODULE_VERSIONS[moduleKey] = 0
-    
-    return MODULE_VERSIONS[moduleKey]
+    with _sessionLock:
+        if moduleKey not in MODULE_VERSIONS:
+            MODULE_VERSIONS[moduleKey] = 0
+        
+        return MODULE_VERSIONS[moduleKey]
 
 def addLoadedDirectoryEntry(moduleKey, version):
-    if moduleKey not in LOADED_BUILD_DIRS:
-        LOADED_BUILD_DIRS[moduleKey] = set()
-    
-    LOADED_BUILD_DIRS[moduleKey].add(version)
+    with _sessionLock:
+        if moduleKey not in LOADED_BUILD_DIRS:
+            LOADED_BUILD_DIRS[moduleKey] = set()
+        
+        LOADED_BUILD_DIRS[moduleKey].add(version)
+        holdBuildDir(version)
 
 def isDirectoryInUse(moduleKey, version):
-    if moduleKey not in LOADED_BUILD_DIRS:
+    with _sessionLock:
+        if moduleKey not in LOADED_BUILD_DIRS:
+            return False
+        
+        return version in LOADED_BUILD_DIRS[moduleKey]
+
+def _countCacheLookup(stat):
+    with _sessionLock:
+        CACHE_STATS[stat] += 1
+
+def _getBuildDirLockFile(buildDir):
+    return os.path.join(buildDir, ".inuse.lock")
+
+def holdBuildDir(buildDir):
+    # Returns False if the hold couldn't be taken (on platforms with flock).
+    if fcntl is None or buildDir in BUILD_DIR_HOLDS:
+        return True
+    try:
+        fd = os.open(_getBuildDirLockFile(buildDir), os.O_RDWR | os.O_CREAT, 0o666)
+    except OSError:
         return False
-    
-    return version in LOADED_BUILD_DIRS[moduleKey]
+    try:
+        fcntl.flock(fd, fcntl.LOCK_SH | fcntl.LOCK_NB)
+    except OSError:
+        os.close(fd)
+        return False
+    BUILD_DIR_HOLDS[buildDir] = fd
+    return True
+
+def releaseBuildDir(buildDir):
+    fd = BUILD_DIR_HOLDS.pop(buildDir, None)
+    if fd is not None:
+        os.close(fd)
+
+def tryLockBuildDirExclusive(buildDir):
+    r'''Returns (True, fd) if no other process holds buildDir. The caller must release fd with 
+        os.close() (fd may be None). Returns (False, None) if the directory is in use.
+        On platforms without flock, loaded binaries can't be renamed or deleted, so 
+        removal fails instead.
+    '''
+    lockFile = _getBuildDirLockFile(buildDir)
+    if fcntl is None or not os.path.exists(lockFile):
+        return (True, None)
+    try:
+        fd = os.open(lockFile, os.O_RDWR)
+    except OSError:
+        return (True, None)
+    try:
+        fcntl.flock(fd, fcntl.LOCK_EX | fcntl.LOCK_NB)
+    except OSError:
+        os.close(fd)
+        return (False, None)
+    return (True, fd)
+
+def isBuildDirHeldElsewhere(buildDir):
+    if buildDir in BUILD_DIR_HOLDS:
+        return False
+    free, fd = tryLockBuildDirExclusive(buildDir)
+    if fd is not None:
+        os.close(fd)
+    return not free
 
 def _replaceFileExt(fileName, newExt, suffix=None):
     baseName, old_extension = os.path.splitext(fileName)
@@ -96,6 +200,84 @@ def doesPlatformAllowReload():
         # Assume linux/unix
         return False
 
+def getUserCacheDir():
+    r'''Per-user directory for caches that are not tied to a source directory. Set with
+        SLANGTORCH_CACHE_DIR, defaults to the platform's user cache location.
+    '''
+    if 'SLANGTORCH_CACHE_DIR' in os.environ:
+        return os.environ['SLANGTORCH_CACHE_DIR']
+    if sys.platform == "win32":
+        return os.path.join(os.environ.get('LOCALAPPDATA', os.path.expanduser('~')), 'slangtorch', 'Cache')
+    if sys.platform == "darwin":
+        return os.path.join(os.path.expanduser('~'), 'Library', 'Caches', 'slangtorch')
+    return os.path.join(os.environ.get('XDG_CACHE_HOME') or os.path.join(os.path.expanduser('~'), '.cache'), 'slangtorch')
+
+# Toolchain information that takes process spawns to derive (the Slang library location, the
+# MSVC install location). Computed once per process and persisted in toolchain.json in the 
+# user cache directory. Each entry is keyed by the identity of the binary it was derived from
+# and is recomputed when that changes.
+#
+TOOLCHAIN_CACHE_FILE = os.path.join(getUserCacheDir(), 'toolchain.json')
+
+_toolchainInfo = {}
+_toolchainInfoLock = threading.RLock()
+
+def getFileIdentity(path):
+    if path is None or not os.path.exists(path):
+        return None
+    path = os.path.realpath(path)
+    stat = os.stat(path)
+    return [path, stat.st_size, stat.st_mtime]
+
+def _readToolchainCacheFile():
+    try:
+        with open(TOOLCHAIN_CACHE_FILE, 'r') as f:
+            return json.load(f)
+    except (OSError, ValueError):
+        return {}
+
+def _writeToolchainCacheFile(toolchainCache):
+    # Write to a private file and rename, so that concurrent readers never see a partial file.
+    # The cache directory may be read-only, in which case the information is only kept in-process.
+    #
+    try:
+        os.makedirs(os.path.dirname(TOOLCHAIN_CACHE_FILE), exist_ok=True)
+        tmpFile = f"{TOOLCHAIN_CACHE_FILE}.{os.getpid()}.{uuid.uuid4().hex}.tmp"
+        with open(tmpFile, 'w') as f:
+            json.dump(toolchainCache, f, indent=4)
+        os.replace(tmpFile, TOOLCHAIN_CACHE_FILE)
+    except OSError:
+        pass
+
+def getCachedToolchainValue(name, identityFn, computeFn, validateFn=None):
+    r'''Returns the cached value of computeFn() for the toolchain entry 'name'. identityFn() 
+        returns a JSON-serializable identity of the inputs, and is only evaluated once per process.
+    '''
+    with _toolchainInfoLock:
+        if name in _toolchainInfo:
+            return _toolchainInfo[name]
+
+        identity = identityFn()
+        toolchainCache = _readToolchainCacheFile()
+        entry = toolchainCache.get(name)
+        if (entry is not None and entry.get("identity") == identity and 
+                (validateFn is None or validateFn(entry.get("value")))):
+            value = entry["value"]
+        else:
+            value = computeFn()
+            toolchainCache[name] = {"identity": identity, "value": value}
+            _writeToolchainCacheFile(toolchainCache)
+
+        _toolchainInfo[name] = value
+        return value
+
+def clearToolchainCache():
+    with _toolchainInfoLock:
+        _toolchainInfo.clear()
+        if os.path.exists(TOOLCHAIN_CACHE_FILE):
+            os.remove(TOOLCHAIN_CACHE_FILE)
+
+
 def find_cl():
     # Look for cl.exe in the default installation path for Visual Studio
     vswhere_path = os.environ.get('ProgramFiles(x86)', '') + '\\Microsoft Visual Studio\\Installer\\vswhere.exe'
@@ -121,9 +303,17 @@ def find_cl():
     return cl_path[0]
 
 
+def findClCached():
+    vswhere_path = os.environ.get('ProgramFiles(x86)', '') + '\\Microsoft Visual Studio\\Installer\\vswhere.exe'
+    return getCachedToolchainValue(
+        "cl",
+        lambda: getFileIdentity(vswhere_path),
+        find_cl,
+        lambda path: path is not None and os.path.exists(path))
+
 def _add_msvc_to_env_var():
     if sys.platform == 'win32':
-        path_to_add = find_cl()
+        path_to_add = findClCached()
         if path_to_add not in os.environ["PATH"].split(os.pathsep):
             os.environ["PATH"] += os.pathsep + path_to_add
 
@@ -262,6 +452,93 @@ def tryGetSlangDynamicLibraryPath():
     return None
 
 
+def getSlangDynamicLibraryPathCached():
+    # The library is located from slangc and the loader search paths.
+    def identity():
+        if sys.platform == "win32":
+            searchPathVars = ["PATH"]
+        elif sys.platform == "darwin":
+            searchPathVars = ["DYLD_LIBRARY_PATH", "DYLD_FALLBACK_LIBRARY_PATH"]
+        else:
+            searchPathVars = ["LD_LIBRARY_PATH"]
+        return [getFileIdentity(slangcPath), [os.environ.get(var, "") for var in searchPathVars]]
+
+    return getCachedToolchainValue(
+        "slangLibrary",
+        identity,
+        tryGetSlangDynamicLibraryPath,
+        lambda path: path is None or os.path.exists(path))
+
+
+def getFileDigest(fileName):
+    hashObject = hashlib.sha256()
+    with open(fileName, 'rb') as f:
+        for chunk in iter(lambda: f.read(1 << 20), b''):
+            hashObject.update(chunk)
+    return hashObject.hexdigest()
+
+
+def makeDependencyEntry(fileName, contentHash=False):
+    # Dependency entries are stored in the metadata as [path, mtime], or as 
+    # [path, mtime, digest] when content hashing is enabled.
+    #
+    if contentHash:
+        return (fileName, os.path.getmtime(fileName), getFileDigest(fileName))
+    return (fileName, os.path.getmtime(fileName))
+
+
+def isDependencyModified(depEntry, verbose=False):
+    depFile, timestamp = depEntry[0], depEntry[1]
+    digest = depEntry[2] if len(depEntry) > 2 else None
+
+    if not os.path.exists(depFile):
+        if verbose:
+            print(f"\tDependency {depFile} does not exist.", file=sys.stderr)
+        return True
+
+    mtime = os.path.getmtime(depFile)
+    if digest is None:
+        return mtime > timestamp
+
+    # The mtime is only a pre-filter in content hash mode. A file that was touched, checked out
+    # or copied without changing its contents is not considered modified.
+    #
+    if mtime == timestamp:
+        return False
+
+    if getFileDigest(depFile) != digest:
+        return True
+
+    if verbose:
+        print(f"\tDependency {depFile} was touched but its contents are unchanged.", file=sys.stderr)
+
+    # Refresh the timestamp so the next check can skip hashing this file.
+    if isinstance(depEntry, list):
+        depEntry[1] = mtime
+
+    return False
+
+
+def getSlangLibraryCompiler(verbose=False):
+    global _slangLibraryCompiler, _slangLibraryCompilerFailed
+
+    with _slangLibraryCompilerLock:
+        if _slangLibraryCompiler is None and not _slangLibraryCompilerFailed:
+            slangLibPath = getSlangDynamicLibraryPathCached()
+            try:
+                if slangLibPath is None:
+                    raise RuntimeError("could not locate the Slang dynamic library")
+                _slangLibraryCompiler = SlangLibraryCompiler(slangLibPath)
+                if verbose:
+                    print(f"Using in-process Slang compiler from {slangLibPath}", file=sys.stderr)
+            except (OSError, AttributeError, RuntimeError) as e:
+                _slangLibraryCompilerFailed = True
+                print(f"Warning: failed to load the Slang library for in-process compilation ({e}). "
+                      f"Falling back to slangc.", file=sys.stderr)
+
+        return _slangLibraryCompiler
+
+
 def getHash(obj, truncate_at=16):
     # Convert obj to JSON string
     jsonString = json.dumps(obj, sort_keys=True)
@@ -287,6 +564,11 @@ def makeOptionsList(defines):
     return list([f"-D{key}={value}" for (key, value) in defines.items()])
 
 
+class VariantOptions(list):
+    r'''Slang options of each variant of a multi-variant module (see loadModuleVariants).'''
+    pass
+
+
 def makeBuildDirPath(baseDir, buildID):
     return os.path.join(baseDir, f"{buildID}")
 
@@ -302,7 +584,7 @@ def getLatestDir(moduleKey, baseDir):
     return (makeBuildDirPath(baseDir, latestBuildID), latestBuildID)
 
 
-def getOrCreateUniqueDir(moduleKey, baseDir):
+def getOrCreateUniqueDir(moduleKey, baseDir, verbose=False):
     # Check if buildDir has a latest.txt file. If so, read the contents.
     # If not, create a latest.txt with '0' as the contents.
     #
@@ -315,8 +597,10 @@ def getOrCreateUniqueDir(moduleKey, baseDir):
 
     targetBuildID = getUniqueSessionVersion(moduleKey)
 
-    while (isDirectoryInUse(moduleKey, makeBuildDirPath(baseDir, targetBuildID))):
-        # If the build directory is in use, we need to create a new build directory.
+    while (isDirectoryInUse(moduleKey, makeBuildDirPath(baseDir, targetBuildID)) or
+           isBuildDirHeldElsewhere(makeBuildDirPath(baseDir, targetBuildID))):
+        # If the build directory is in use (by this process or another one), we need to
+        # create a new build directory.
         targetBuildID = getUniqueSessionVersion(moduleKey)
     
     targetDir = None
@@ -340,11 +624,9 @@ def getOrCreateUniqueDir(moduleKey, baseDir):
         targetDir = makeBuildDirPath(baseDir, targetBuildID)
 
         if os.path.exists(targetDir):
-            import shutil
             shutil.rmtree(targetDir)
 
-        import distutils.dir_util
-        distutils.dir_util.copy_tree(latestDir, targetDir)
+        cloneBuildDir(latestDir, targetDir, verbose=verbose)
 
         # Modify the build-dir-sensitive metadata in metadata.json
         metadataFile = os.path.join(targetDir, "metadata.json")
@@ -372,7 +654,86 @@ def getOrCreateUniqueDir(moduleKey, baseDir):
     return targetDir, targetBuildID
 
 
-def compileSlang(metadata, fileName, targetMode, options, outputFile, verbose=False, includePaths=[], dryRun=False, extraSlangFlags=[]):
+def getKeepBuildsCount():
+    return int(os.environ.get('SLANGTORCH_KEEP_BUILDS', '3'))
+
+
+def _getBuildDirLastUsed(buildDir):
+    metadataFile = os.path.join(buildDir, "metadata.json")
+    if os.path.exists(metadataFile):
+        return os.path.getmtime(metadataFile)
+    return os.path.getmtime(buildDir)
+
+
+def _removeBuildDir(baseDir, buildDir):
+    r'''Removes buildDir unless another process holds it. Returns True if it was removed.
+    '''
+    free, fd = tryLockBuildDirExclusive(buildDir)
+    if not free:
+        return False
+
+    # Move the directory out of the numbered namespace first, so that a partially deleted
+    # directory is never mistaken for a build.
+    #
+    trashDir = os.path.join(baseDir, f".stale-{uuid.uuid4().hex}")
+    try:
+        os.rename(buildDir, trashDir)
+    except OSError:
+        return False
+    finally:
+        if fd is not None:
+            os.close(fd)
+
+    shutil.rmtree(trashDir, ignore_errors=True)
+    return True
+
+
+def _collectStaleBuildDirs(baseDir, keep, verbose=False):
+    r'''Removes all but the 'keep' most recently used numbered build directories in baseDir.
+        The latest build, directories loaded by this process and directories held by other 
+        processes are never removed. The caller must hold the module lock.
+    '''
+    if not os.path.isdir(baseDir):
+        return []
+
+    _, latestBuildID = getLatestDir(baseDir, baseDir)
+    loadedDirs = set(os.path.normpath(d) for d in LOADED_BUILD_DIRS.get(baseDir, set()))
+
+    candidates = []
+    for entry in os.listdir(baseDir):
+        path = os.path.join(baseDir, entry)
+        if entry.startswith(".stale-"):
+            # Left over from an interrupted collection.
+            shutil.rmtree(path, ignore_errors=True)
+            continue
+        if not (entry.isdigit() and os.path.isdir(path)):
+            continue
+        if int(entry) == latestBuildID:
+            continue
+        try:
+            candidates.append((_getBuildDirLastUsed(path), path))
+        except OSError:
+            continue
+
+    # The latest build counts towards the kept directories.
+    candidates.sort(reverse=True)
+    stale = candidates[max(keep - 1, 0):]
+
+    removed = []
+    for (_, buildDir) in stale:
+        if os.path.normpath(buildDir) in loadedDirs:
+            continue
+        if _removeBuildDir(baseDir, buildDir):
+            removed.append(buildDir)
+            if verbose:
+                print(f"Removed stale build directory {buildDir}", file=sys.stderr)
+        elif verbose:
+            print(f"Build directory {buildDir} is in use by another process, skipping", file=sys.stderr)
+
+    return removed
+
+
+def slangOutputNeedsRecompile(metadata, options, outputFile, verbose=False, includePaths=[]):
     needsRecompile = False
 
     # If version either doesn't exist or is different, we need to recompile.
@@ -397,19 +758,13 @@ def compileSlang(metadata, fileName, targetMode, options, outputFile, verbose=Fa
                 print(f"Output file {outputFile} does not exist. Needs recompile.", file=sys.stderr)
             needsRecompile = True
         else:
-            for depFile, timestamp in depFiles:
+            for depEntry in depFiles:
                 if verbose:
-                    print(f"Checking dependency: {depFile}", file=sys.stderr)
-                
-                if not os.path.exists(depFile):
-                    if verbose:
-                        print(f"\tDependency does not exist. Needs recompile.", file=sys.stderr)
-                    needsRecompile = True
-                    break
-                
-                if os.path.getmtime(depFile) > timestamp:
+                    print(f"Checking dependency: {depEntry[0]}", file=sys.stderr)
+
+                if isDependencyModified(depEntry, verbose):
                     if verbose:
-                        print(f"\tDependency is newer. Needs recompile.", file=sys.stderr)
+                        print(f"\tDependency is modified. Needs recompile.", file=sys.stderr)
                     needsRecompile = True
                     break
     else:
@@ -442,60 +797,200 @@ def compileSlang(metadata, fileName, targetMode, options, outputFile, verbose=Fa
             needsRecompile = True
     else:
         needsRecompile = True
-    
+
+    return needsRecompile
+
+
+def compileSlang(metadata, fileName, targetMode, options, outputFile, verbose=False, includePaths=[], dryRun=False, extraSlangFlags=[], contentHash=False):
+    needsRecompile = slangOutputNeedsRecompile(metadata, options, outputFile, verbose, includePaths)
+
     if needsRecompile:
-        return True, (_compileSlang(metadata, fileName, targetMode, options, outputFile, includePaths, verbose, extraSlangFlags) if not dryRun else None)
+        return True, (_compileSlang(metadata, fileName, targetMode, options, outputFile, includePaths, verbose, extraSlangFlags, contentHash) if not dryRun else None)
     else:
         return False, (metadata if not dryRun else None)
 
 
-def _compileSlang(metadata, fileName, targetMode, options, outputFile, includePaths=[], verbose=False, extraSlangFlags=[]):
-    # Create a temporary depfile path.
-    depFile = f"{outputFile}.d.out"
+def compileSlangTargets(metadata, fileName, targets, options, verbose=False, includePaths=[], dryRun=False, extraSlangFlags=[], contentHash=False):
+    # Same as compileSlang(), but for several (metadataKey, targetMode, outputFile) targets of the
+    # same source file. The targets that need a recompile are compiled concurrently, and share a 
+    # single dependency list.
+    #
+    # Returns (anyRecompiled, {metadataKey: targetMetadata})
+    #
+    results = {}
+    staleTargets = []
+    for (key, targetMode, outputFile) in targets:
+        targetMetadata = metadata.get(key, None) if metadata else None
+        if slangOutputNeedsRecompile(targetMetadata, options, outputFile, verbose, includePaths):
+            staleTargets.append((key, targetMode, outputFile))
+            results[key] = None
+        else:
+            results[key] = targetMetadata if not dryRun else None
 
+    if not staleTargets or dryRun:
+        return len(staleTargets) > 0, results
+
+    newMetadata = _compileSlangTargets(fileName, [(targetMode, outputFile) for (_, targetMode, outputFile) in staleTargets],
+                                       options, includePaths, verbose, extraSlangFlags, contentHash)
+    for (key, _, _), targetMetadata in zip(staleTargets, newMetadata):
+        results[key] = targetMetadata
+
+    return True, results
+
+
+def _makeSlangCompileCommand(fileName, targetMode, options, outputFile, depFile=None, includePaths=[], extraSlangFlags=[]):
     compileCommand = [slangcPath, fileName, *options, 
                       '-target', targetMode,
-                      '-o', outputFile,
-                      '-depfile', depFile,
-                      '-ignore-capabilities']
+                      '-o', outputFile]
+    if depFile is not None:
+        compileCommand.extend(['-depfile', depFile])
+    compileCommand.append('-ignore-capabilities')
     compileCommand.extend(extraSlangFlags)
 
     if includePaths is not None:
         for includePath in includePaths:
             compileCommand.extend(["-I", includePath])
 
-    if verbose:
-        print(f"Building {os.path.basename(fileName)} -> {os.path.basename(outputFile)}: ", 
-              " ".join(compileCommand), file=sys.stderr)
+    return compileCommand
 
-    result = subprocess.run(compileCommand, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
-    slangcErr = result.stderr.decode('utf-8')
-    if slangcErr.strip():
-        print(slangcErr, file=sys.stderr)
-    if result.returncode != 0:
-        raise RuntimeError(f"Compilation failed with error {result.returncode}")
+
+def _compileSlang(metadata, fileName, targetMode, options, outputFile, includePaths=[], verbose=False, extraSlangFlags=[], contentHash=False):
+    return _compileSlangTargets(fileName, [(targetMode, outputFile)], options, includePaths, verbose, extraSlangFlags, contentHash)[0]
+
+
+def _getTemporaryOutputPath(outputFile):
+    # Keep the extension, slangc may look at it.
+    root, ext = os.path.splitext(outputFile)
+    return f"{root}.{os.getpid()}.{uuid.uuid4().hex[:8]}.tmp{ext}"
+
+
+def _replaceFileIfChanged(tmpFile, outputFile, verbose=False):
+    # Keep the existing file, and its mtime, if the new contents are identical. ninja then skips
+    # the translation units whose generated source didn't change.
+    #
+    if os.path.exists(outputFile) and os.path.getsize(outputFile) == os.path.getsize(tmpFile):
+        with open(outputFile, 'rb') as f1, open(tmpFile, 'rb') as f2:
+            if f1.read() == f2.read():
+                if verbose:
+                    print(f"{os.path.basename(outputFile)} is unchanged.", file=sys.stderr)
+                os.remove(tmpFile)
+                return False
+
+    os.replace(tmpFile, outputFile)
+    return True
+
+
+def _compileSlangTargets(fileName, targets, options, includePaths=[], verbose=False, extraSlangFlags=[], contentHash=False):
+    # Compile to temporary files, and only replace the outputs whose contents changed.
+    tmpFiles = [_getTemporaryOutputPath(outputFile) for (_, outputFile) in targets]
+    try:
+        metadata = _runSlangCompiler(fileName, [(targetMode, tmpFile) for (targetMode, _), tmpFile in zip(targets, tmpFiles)],
+                                     options, includePaths, verbose, extraSlangFlags, contentHash)
+        for (_, outputFile), tmpFile in zip(targets, tmpFiles):
+            _replaceFileIfChanged(tmpFile, outputFile, verbose)
+    finally:
+        for tmpFile in tmpFiles:
+            if os.path.exists(tmpFile):
+                os.remove(tmpFile)
+
+    return metadata
+
+
+def _runSlangCompiler(fileName, targets, options, includePaths=[], verbose=False, extraSlangFlags=[], contentHash=False):
+    if slangCompileBackend == 'library':
+        compiler = getSlangLibraryCompiler(verbose)
+        if compiler is not None:
+            with getJobBudget(verbose).reserve(1):
+                return _compileSlangTargetsInProcess(compiler, fileName, targets, options, includePaths, verbose, extraSlangFlags, contentHash)
+
+    # All targets are produced from the same source, options & include paths, so they have the
+    # same dependencies. Only the first invocation writes a depfile.
+    #
+    depFile = f"{targets[0][1]}.d.out"
+
+    # slangc processes count against the compiler job budget. If fewer slots than targets are
+    # granted, the targets are compiled in batches.
+    #
+    failedReturnCode = None
+    with getJobBudget(verbose).reserve(len(targets)) as batchSize:
+        for batchStart in range(0, len(targets), batchSize):
+            processes = []
+            for index, (targetMode, outputFile) in enumerate(targets[batchStart:batchStart + batchSize], batchStart):
+                compileCommand = _makeSlangCompileCommand(
+                    fileName, targetMode, options, outputFile,
+                    depFile if index == 0 else None, includePaths, extraSlangFlags)
+
+                if verbose:
+                    print(f"Building {os.path.basename(fileName)} -> {os.path.basename(outputFile)}: ", 
+                          " ".join(compileCommand), file=sys.stderr)
+
+                processes.append(subprocess.Popen(compileCommand, stdout=subprocess.PIPE, stderr=subprocess.PIPE))
+
+            for process in processes:
+                _, stderr = process.communicate()
+                slangcErr = stderr.decode('utf-8')
+                if slangcErr.strip():
+                    print(slangcErr, file=sys.stderr)
+                if process.returncode != 0 and failedReturnCode is None:
+                    failedReturnCode = process.returncode
+
+    if failedReturnCode is not None:
+        if os.path.exists(depFile):
+            os.remove(depFile)
+        raise RuntimeError(f"Compilation failed with error {failedReturnCode}")
     
-    deps = parseDepfile(depFile)
+    deps = parseDepfile(depFile, contentHash)
 
     # Add slangc executable & dynamic library location & mtime to the dependency list.
-    deps.append((slangcPath, os.path.getmtime(slangcPath)))
+    deps.append(makeDependencyEntry(slangcPath, contentHash))
 
-    slangLibPath = tryGetSlangDynamicLibraryPath()
+    slangLibPath = getSlangDynamicLibraryPathCached()
     if slangLibPath is not None:
-        deps.append((slangLibPath, os.path.getmtime(slangLibPath)))
+        deps.append(makeDependencyEntry(slangLibPath, contentHash))
 
     # Erase depfile.
     os.remove(depFile)
 
     # Update metadata.
-    return {"options": options, "deps": deps, "version": versionCode, "includePaths": includePaths}
+    return [{"options": options, "deps": list(deps), "version": versionCode, "includePaths": includePaths} for _ in targets]
 
 
-def compileAndLoadModule(metadata, sources, moduleName, buildDir, slangSourceDir=None, verbose=False, dryRun=False, skipNinjaCheck=False, extraCudaFlags=[], extraSyclFlags=[]):
-    needsRebuild = False
-    needsReload = False
+def _compileSlangTargetsInProcess(compiler, fileName, targets, options, includePaths=[], verbose=False, extraSlangFlags=[], contentHash=False):
+    deps = None
+    for (targetMode, outputFile) in targets:
+        # Same arguments as for slangc, minus the executable. Dependencies are queried from the
+        # compile request instead of going through a depfile.
+        #
+        compileArgs = _makeSlangCompileCommand(
+            fileName, targetMode, options, outputFile, None, includePaths, extraSlangFlags)[1:]
 
-    newMetadata = metadata.copy()
+        if verbose:
+            print(f"Building {os.path.basename(fileName)} -> {os.path.basename(outputFile)} (in-process): ", 
+                  " ".join(compileArgs), file=sys.stderr)
+
+        returnCode, diagnostics, dependencyFiles = compiler.compile(compileArgs)
+        if diagnostics.strip():
+            print(diagnostics, file=sys.stderr)
+        if returnCode != 0:
+            raise RuntimeError(f"Compilation failed with error {returnCode}")
+
+        if deps is None:
+            deps = []
+            seen = set()
+            for depFile in dependencyFiles:
+                depFile = os.path.realpath(depFile)
+                if depFile not in seen and os.path.exists(depFile):
+                    seen.add(depFile)
+                    deps.append(makeDependencyEntry(depFile, contentHash))
+
+    # The library itself stands in for slangc in the dependency list.
+    deps.append(makeDependencyEntry(compiler.libraryPath, contentHash))
+
+    return [{"options": options, "deps": list(deps), "version": versionCode, "includePaths": includePaths} for _ in targets]
+
+
+def moduleBinaryNeedsRebuild(metadata, sources, verbose=False):
+    needsRebuild = False
 
     # Check if any of the sources are newer than the module binary.
     if metadata and metadata.get("moduleBinary", None):
@@ -511,6 +1006,12 @@ def compileAndLoadModule(metadata, sources, moduleName, buildDir, slangSourceDir
                     raise RuntimeError(f"Dependency {source} does not exist")
 
                 if os.path.getmtime(source) > os.path.getmtime(moduleBinary):
+                    # In content hash mode, a source that was rewritten with identical contents
+                    # does not invalidate the binary.
+                    sourceEntry = dict((entry[0], entry) for entry in metadata.get("sources", None) or []).get(source, None)
+                    if sourceEntry is not None and len(sourceEntry) > 2 and not isDependencyModified(sourceEntry, verbose):
+                        continue
+
                     if verbose:
                         print("Dependency is newer than module binary. Rebuilding.", file=sys.stderr)
                     needsRebuild = True
@@ -522,6 +1023,189 @@ def compileAndLoadModule(metadata, sources, moduleName, buildDir, slangSourceDir
     else:
         needsRebuild = True
 
+    return needsRebuild
+
+
+def downstreamDepsChanged(metadata, verbose=False):
+    # Downstream dependencies are the files that ninja recorded for the host & kernel
+    # compiles (prelude headers, user-defined headers, torch headers). If they were never 
+    # recorded, we can't vouch for them.
+    #
+    downstreamDeps = metadata.get("downstreamDeps", None) if metadata else None
+    if downstreamDeps is None:
+        if verbose:
+            print("Downstream dependencies not recorded.", file=sys.stderr)
+        return True
+
+    for depEntry in downstreamDeps:
+        if isDependencyModified(depEntry, verbose):
+            if verbose:
+                print(f"Downstream dependency {depEntry[0]} is modified.", file=sys.stderr)
+            return True
+
+    return False
+
+
+def _collectDownstreamDeps(buildDir, contentHash=False):
+    deps = collect_ninja_deps(os.path.realpath(buildDir))
+    if deps is None:
+        return None
+
+    return [makeDependencyEntry(depFile, contentHash) for depFile in deps if os.path.exists(depFile)]
+
+
+# Copies of an incrementally rebuilt binary are named <moduleName>.r<revision>.<ext>
+RELOAD_BINARY_PATTERN = re.compile(r"^(?P<moduleName>.+)\.r(?P<revision>[0-9]+)\.(?P<extension>so|pyd)$")
+
+def _getBuiltBinaryStat(buildDir, moduleName):
+    try:
+        return _getFileStat(os.path.join(buildDir, f"{moduleName}.{getPyModuleExtension()}"))
+    except OSError:
+        return None
+
+
+def _copyBinaryForReload(buildDir, moduleName, previousBinary=None, verbose=False):
+    r'''Copies the binary built in buildDir to a new file that can be imported alongside the copy 
+        loaded before. Removes older copies, except previousBinary. Returns the path of the copy.
+    '''
+    # The dynamic loader identifies a library by its path (and inode, so a hard link won't do),
+    # and hands out the image that is already loaded for a binary that was relinked in place. 
+    # The module name (and its init symbol) stays the same, only the file name changes.
+    #
+    builtBinary = os.path.join(buildDir, f"{moduleName}.{getPyModuleExtension()}")
+
+    copies = {}
+    for entry in os.listdir(buildDir):
+        match = RELOAD_BINARY_PATTERN.match(entry)
+        if match and match.group("moduleName") == moduleName:
+            copies[int(match.group("revision"))] = os.path.join(buildDir, entry)
+
+    revision = max(copies, default=0) + 1
+    reloadBinary = os.path.join(buildDir, f"{moduleName}.r{revision}.{getPyModuleExtension()}")
+
+    tmpFile = f"{reloadBinary}.{os.getpid()}.tmp"
+    shutil.copy2(builtBinary, tmpFile)
+    os.replace(tmpFile, reloadBinary)
+
+    # Copies loaded by this process stay mapped after they are removed. The previous one may 
+    # still be published, and is being loaded by other processes.
+    #
+    for copy in copies.values():
+        if previousBinary is None or os.path.realpath(copy) != os.path.realpath(previousBinary):
+            try:
+                os.remove(copy)
+            except OSError:
+                pass
+
+    if verbose:
+        print(f"Loading incremental build from {reloadBinary}", file=sys.stderr)
+    return reloadBinary
+
+
+def _importModuleBinary(moduleName, moduleBinary):
+    import importlib.util
+    spec = importlib.util.spec_from_file_location(moduleName, moduleBinary)
+    slangLib = importlib.util.module_from_spec(spec)
+    spec.loader.exec_module(slangLib)
+    return slangLib
+
+
+_toolchainFingerprint = None
+
+def getToolchainFingerprint():
+    # Identity of everything downstream of Slang that affects the built binary. Computed
+    # from file stats only, once per process.
+    #
+    global _toolchainFingerprint
+    if _toolchainFingerprint is not None:
+        return _toolchainFingerprint
+
+    import sysconfig
+    import torch
+    from torch.utils.cpp_extension import CUDA_HOME
+
+    cxx = os.environ.get('CXX', 'cl' if sys.platform == "win32" else 'c++')
+    nvcc = os.path.join(CUDA_HOME, 'bin', 'nvcc' + executable_extension) if CUDA_HOME else None
+
+    _toolchainFingerprint = {
+        "torch": torch.__version__,
+        "python": sysconfig.get_config_var('EXT_SUFFIX'),
+        "platform": sys.platform,
+        "cxx": getFileIdentity(shutil.which(cxx)),
+        "nvcc": getFileIdentity(nvcc),
+    }
+    return _toolchainFingerprint
+
+
+_globalBuildCaches = {}
+
+def getGlobalBuildCache(globalCacheDir):
+    if not globalCacheDir:
+        return None
+
+    globalCacheDir = os.path.realpath(globalCacheDir)
+    with _sessionLock:
+        if globalCacheDir not in _globalBuildCaches:
+            maxSizeMB = int(os.environ.get('SLANGTORCH_GLOBAL_CACHE_MAX_SIZE_MB', '10240'))
+            _globalBuildCaches[globalCacheDir] = GlobalBuildCache(globalCacheDir, maxSizeMB * 1024 * 1024)
+
+        return _globalBuildCaches[globalCacheDir]
+
+
+def _getGlobalCacheKey(sources, slangSourceDir, extraCudaFlags, extraSyclFlags):
+    extra_cflags, extra_cuda_cflags, extra_sycl_cflags = _getDownstreamCompileFlags(extraCudaFlags, extraSyclFlags)
+    return GlobalBuildCache.makeKey(
+        sources, [extra_cflags, extra_cuda_cflags, extra_sycl_cflags], getToolchainFingerprint(), slangSourceDir)
+
+
+def _loadFromGlobalCache(globalCache, globalCacheKey, metadata, buildDir, slangSourceDir, contentHash=False, verbose=False):
+    cacheEntry = globalCache.lookup(globalCacheKey, slangSourceDir, verbose)
+    if cacheEntry is None:
+        return None, None
+
+    cachedModuleName, cachedModuleBinary, headerDeps = cacheEntry
+
+    # Bring the binary into the build directory, so that the build directory stays self-contained.
+    # It's a copy rather than a hardlink: the dynamic loader identifies libraries by inode, and
+    # would hand back the handle of another build directory's binary that is already loaded.
+    #
+    localModuleBinary = os.path.join(buildDir, os.path.basename(cachedModuleBinary))
+    try:
+        if os.path.exists(localModuleBinary):
+            os.remove(localModuleBinary)
+        copyFile(cachedModuleBinary, localModuleBinary)
+
+        # The binary must not look older than the freshly generated sources.
+        os.utime(localModuleBinary, None)
+
+        slangLib = _importModuleBinary(cachedModuleName, localModuleBinary)
+    except Exception as e:
+        if verbose:
+            print(f"Failed to use global cache entry {globalCacheKey[:16]}: {e}", file=sys.stderr)
+        return None, None
+
+    if verbose:
+        print(f"Global cache hit ({globalCacheKey[:16]}). Using {cachedModuleName}", file=sys.stderr)
+
+    newMetadata = metadata.copy()
+    newMetadata["moduleName"] = cachedModuleName
+    newMetadata["moduleBinary"] = localModuleBinary
+    newMetadata["downstreamDeps"] = [makeDependencyEntry(depFile, contentHash) for depFile in headerDeps]
+    newMetadata["globalCacheKey"] = globalCacheKey
+
+    return slangLib, newMetadata
+
+
+def compileAndLoadModule(metadata, sources, moduleName, buildDir, slangSourceDir=None, verbose=False, dryRun=False, skipNinjaCheck=False, extraCudaFlags=[], extraSyclFlags=[], contentHash=False, globalCache=None, sharedPrelude=False, splitModule=False):
+    needsReload = False
+    ranNinja = False
+    builtModule = False
+    globalCacheKey = None
+
+    newMetadata = metadata.copy()
+
+    needsRebuild = moduleBinaryNeedsRebuild(metadata, sources, verbose)
+
     if not needsRebuild and not skipNinjaCheck:
         # One more check: we will run ninja on the build directory to see if there is anything to do.
         # This check catches the case where the Slang products are up-to-date, but any downstream 
@@ -533,7 +1217,8 @@ def compileAndLoadModule(metadata, sources, moduleName, buildDir, slangSourceDir
         # verbose set to False on purpose to avoid clogging up the console with the trial run
         # which is expected to show failure messages even on certain successful states.
         #
-        ninja_result = run_ninja(buildDir, verbose=False)
+        ninja_result = run_ninja(buildDir, verbose=False, jobs=len(sources))
+        ranNinja = True
 
         if ninja_result == NinjaResult.BUILD_SUCCESS:
             if verbose:
@@ -557,23 +1242,28 @@ def compileAndLoadModule(metadata, sources, moduleName, buildDir, slangSourceDir
         if not needsRebuild and skipNinjaCheck and verbose:
             print(f"Skipping additional ninja check (WARNING: this may ignore changes to non-slang files)", file=sys.stderr)
 
-    # If our platform doesn't allow reloading the same binary (e.g. most linux flavors),
-    # then we'll fall back to rebuild.
+    # If our platform doesn't allow reloading the same binary (e.g. most linux flavors), the 
+    # incremental build is loaded from a copy instead. Compare against the binary that was 
+    # last loaded, since an earlier dry run may have relinked it already. Builds that didn't
+    # record it fall back to a rebuild.
     #
-    if needsReload and not doesPlatformAllowReload():
-        needsRebuild = True
+    if not needsRebuild and not doesPlatformAllowReload():
+        if metadata.get("builtBinary") is None:
+            needsRebuild = needsReload
+        elif _getBuiltBinaryStat(buildDir, metadata["moduleName"]) != metadata["builtBinary"]:
+            needsReload = True
 
     cacheLookupKey = moduleName
     if not needsRebuild:
         if not needsReload:
             # Try the session cache. If we find a hit, the module is already loaded.
-            if compileAndLoadModule._moduleCache is not None:
-                if cacheLookupKey in compileAndLoadModule._moduleCache:
-                    if verbose:
-                        print(f"Build & load skipped. Using cached module ({cacheLookupKey})", file=sys.stderr)
-                    if dryRun:
-                        return False, None
-                    return compileAndLoadModule._moduleCache[cacheLookupKey], newMetadata
+            cachedModule = _getSessionCachedModule(cacheLookupKey, metadata["moduleBinary"])
+            if cachedModule is not None:
+                if verbose:
+                    print(f"Build & load skipped. Using cached module ({cacheLookupKey})", file=sys.stderr)
+                if dryRun:
+                    return False, None
+                return cachedModule, newMetadata
         
         # If not, try the persistent cache (load shared object). It's a lot quicker to import the binary
         # than going through torch's build-file generation + ninja dependency detection
@@ -585,11 +1275,10 @@ def compileAndLoadModule(metadata, sources, moduleName, buildDir, slangSourceDir
                 return False, None
             
             try:
-                import importlib.util
-                spec = importlib.util.spec_from_file_location(
-                    metadata["moduleName"], moduleBinary)
-                slangLib = importlib.util.module_from_spec(spec)
-                spec.loader.exec_module(slangLib)
+                if needsReload and not doesPlatformAllowReload():
+                    moduleBinary = _copyBinaryForReload(buildDir, metadata["moduleName"], moduleBinary, verbose)
+                    newMetadata["moduleBinary"] = moduleBinary
+                slangLib = _importModuleBinary(metadata["moduleName"], moduleBinary)
             except Exception as e:
                 if verbose:
                     print(f"Failed to load existing module binary {moduleBinary}: {e}", file=sys.stderr)
@@ -603,16 +1292,58 @@ def compileAndLoadModule(metadata, sources, moduleName, buildDir, slangSourceDir
         if dryRun:
             return True, None
         
-        # Compile the module.
-        slangLib = _compileAndLoadModule(metadata, sources, moduleName, buildDir, slangSourceDir, extraCudaFlags, extraSyclFlags, verbose)
+        slangLib = None
+
+        # An identical build may already exist in the global cache (same generated sources,
+        # flags & toolchain, possibly from a different source directory).
+        #
+        if globalCache is not None:
+            globalCacheKey = _getGlobalCacheKey(sources, slangSourceDir, extraCudaFlags, extraSyclFlags)
+            slangLib, newMetadata = _loadFromGlobalCache(globalCache, globalCacheKey, metadata, buildDir, slangSourceDir, contentHash, verbose)
+
+        if slangLib is None:
+            # Compile the module.
+            slangLib = _compileAndLoadModule(metadata, sources, moduleName, buildDir, slangSourceDir, extraCudaFlags, extraSyclFlags, verbose, sharedPrelude, splitModule)
+            builtModule = True
 
-        newMetadata = metadata.copy()
-        newMetadata["moduleName"] = moduleName
-        newMetadata["moduleBinary"] = os.path.join(buildDir, f"{moduleName}.{getPyModuleExtension()}")
+            newMetadata = metadata.copy()
+            newMetadata["moduleName"] = moduleName
+            newMetadata["moduleBinary"] = os.path.join(buildDir, f"{moduleName}.{getPyModuleExtension()}")
+            newMetadata.pop("globalCacheKey", None)
+
+        newMetadata["sources"] = [makeDependencyEntry(source, contentHash) for source in sources] if contentHash else None
     
     if dryRun:
         return False, None
+
+    # Record the downstream dependencies so that the next load can validate the build 
+    # without running ninja. Only refresh them when ninja actually had a look at the build.
+    #
+    if builtModule or (ranNinja and not needsRebuild) or "downstreamDeps" not in newMetadata:
+        newMetadata["downstreamDeps"] = _collectDownstreamDeps(buildDir, contentHash)
+
+    # Modules linked against a shared prelude library need the copy of the library in their build
+    # directory, which the cache entry doesn't carry.
+    #
+    if (builtModule and globalCache is not None and newMetadata["downstreamDeps"] is not None and
+            not sharedPrelude):
+        # The generated sources (and the precompiled prelude derived from them) are part of the key
+        # already, and live in a directory specific to this build.
+        #
+        realSources = set(os.path.realpath(source) for source in sources)
+        pchRoot = getPrecompiledPreludeRoot(slangSourceDir) if slangSourceDir else None
+        globalCache.insert(
+            globalCacheKey, moduleName, newMetadata["moduleBinary"],
+            [depEntry[0] for depEntry in newMetadata["downstreamDeps"]
+             if depEntry[0] not in realSources and not isModuleDefinitionFile(depEntry[0]) and
+                not (pchRoot and isPrecompiledPreludeFile(depEntry[0], pchRoot))],
+            slangSourceDir, verbose)
+        globalCache.inUse.add(globalCacheKey)
     
+    # Remember which build of the binary is loaded, see above.
+    if not doesPlatformAllowReload():
+        newMetadata["builtBinary"] = _getBuiltBinaryStat(buildDir, newMetadata["moduleName"])
+
     # Cache the module for later.
     compileAndLoadModule._moduleCache[cacheLookupKey] = slangLib
 
@@ -622,10 +1353,20 @@ def compileAndLoadModule(metadata, sources, moduleName, buildDir, slangSourceDir
 compileAndLoadModule._moduleCache = {}
 
 
-def _compileAndLoadModule(metadata, sources, moduleName, buildDir, slangSourceDir, extraCudaFlags=[], extraSyclFlags=[], verbose=False):
-    # make sure to add cl.exe to PATH on windows so ninja can find it.
-    _add_msvc_to_env_var()
+def _getSessionCachedModule(moduleName, moduleBinary):
+    # Another process may have reloaded an incremental build of the module from a new copy
+    # of the binary (see _copyBinaryForReload), in which case the loaded one is stale.
+    #
+    cachedModule = compileAndLoadModule._moduleCache.get(moduleName)
+    if cachedModule is None:
+        return None
+    loadedBinary = getattr(cachedModule, "__file__", None)
+    if loadedBinary is not None and os.path.realpath(loadedBinary) != os.path.realpath(moduleBinary):
+        return None
+    return cachedModule
+
 
+def _getDownstreamCompileFlags(extraCudaFlags=[], extraSyclFlags=[]):
     extra_cflags = []
     extra_cuda_cflags = []
     # If windows, add /std:c++17 to extra_cflags
@@ -641,21 +1382,97 @@ def _compileAndLoadModule(metadata, sources, moduleName, buildDir, slangSourceDi
     if extraCudaFlags:
         extra_cuda_cflags.extend(extraCudaFlags)
 
+    extra_cuda_cflags = extra_cuda_cflags + DEFAULT_CUDA_CFLAGS
+    extra_sycl_cflags = extraSyclFlags if extraSyclFlags else []
+
+    return extra_cflags, extra_cuda_cflags, extra_sycl_cflags
+
+
+def usePrecompiledPrelude():
+    # MSVC precompiled headers need a separate object file for the header, and aren't supported.
+    # The header is included the way GCC finds precompiled headers, so the default is limited to
+    # Linux, where the host compiler is usually GCC (see util/pch.py).
+    #
+    if sys.platform == "win32":
+        return False
+    default = '1' if sys.platform.startswith("linux") else '0'
+    return os.environ.get('SLANGTORCH_PRECOMPILED_PRELUDE', default) == '1'
+
+
+def useSharedPreludeLibrary():
+    # The shared prelude library is linked with an $ORIGIN rpath, which is specific to ELF.
+    #
+    if not sys.platform.startswith("linux"):
+        return False
+    return os.environ.get('SLANGTORCH_SHARED_PRELUDE', '0') == '1'
+
+
+def getPrecompiledPreludeRoot(slangSourceDir):
+    return os.path.join(slangSourceDir, ".slangtorch_cache", ".pch")
+
+
+def getObjectCacheDirPath():
+    return os.environ.get('SLANGTORCH_OBJECT_CACHE_DIR', os.path.join(getUserCacheDir(), 'objects'))
+
+
+def getObjectCacheDir():
+    # Object-level compile cache shared by all modules (see util/objcache.py). Enabled by default
+    # on Linux and macOS, disabled with SLANGTORCH_OBJECT_CACHE=0 or if the directory isn't writable.
+    #
+    if sys.platform == "win32" or os.environ.get('SLANGTORCH_OBJECT_CACHE', '1') == '0':
+        return None
+    objectCacheDir = getObjectCacheDirPath()
+    try:
+        os.makedirs(objectCacheDir, exist_ok=True)
+    except OSError:
+        return None
+    if not os.access(objectCacheDir, os.W_OK):
+        return None
+    return os.path.realpath(objectCacheDir)
+
+
+def _compileAndLoadModule(metadata, sources, moduleName, buildDir, slangSourceDir, extraCudaFlags=[], extraSyclFlags=[], verbose=False, sharedPrelude=False, splitModule=False):
+    # make sure to add cl.exe to PATH on windows so ninja can find it.
+    _add_msvc_to_env_var()
+
+    extra_cflags, extra_cuda_cflags, extra_sycl_cflags = _getDownstreamCompileFlags(extraCudaFlags, extraSyclFlags)
+
     if slangSourceDir:
         extra_include_paths = [slangSourceDir]
     else:
         extra_include_paths = None
 
-    extra_cuda_cflags = extra_cuda_cflags + DEFAULT_CUDA_CFLAGS
-    extra_sycl_cflags = extraSyclFlags if extraSyclFlags else []
-    
-    return jit_compile(
+    # The module name is only defined in a source of its own, so that the object cache can share
+    # the host source between builds, and so that a build cloned for a new build ID (splitModule)
+    # doesn't recompile the host source.
+    #
+    # Paths in the generated sources and in the Slang source directory are left out of the 
+    # object cache keys, so that builds of other options or source directories share objects.
+    #
+    objectCacheDir = getObjectCacheDir()
+    objectCacheBaseDirs = []
+    if objectCacheDir is not None or splitModule:
+        sources = splitModuleDefinition(sources)
+    if objectCacheDir is not None:
+        baseDirs = [os.path.dirname(sources[0])] + ([slangSourceDir] if slangSourceDir else [])
+        objectCacheBaseDirs = list(dict.fromkeys(
+            path for baseDir in baseDirs for path in (os.path.realpath(baseDir), os.path.abspath(baseDir))))
+
+    # Compile the host source against a precompiled header of its (large, shared) prelude.
+    extra_ldflags = []
+    if slangSourceDir and usePrecompiledPrelude():
+        sources, pch_cflags, extra_ldflags = getPrecompiledPreludeSources(
+            sources, getPrecompiledPreludeRoot(slangSourceDir), extra_cflags, extra_include_paths,
+            getToolchainFingerprint(), sharedPrelude, os.path.realpath(buildDir), verbose)
+        extra_cflags = extra_cflags + pch_cflags
+
+    module = jit_compile(
         moduleName,
         sources,
         extra_cflags=extra_cflags,
         extra_cuda_cflags=extra_cuda_cflags if extra_cuda_cflags else None,
         extra_sycl_cflags=extra_sycl_cflags if extra_sycl_cflags else None,
-        extra_ldflags=None,
+        extra_ldflags=extra_ldflags if extra_ldflags else None,
         extra_include_paths=extra_include_paths,
         build_directory=os.path.realpath(buildDir),
         verbose=verbose,
@@ -663,10 +1480,20 @@ def _compileAndLoadModule(metadata, sources, moduleName, buildDir, slangSourceDi
         is_standalone=False,
         keep_intermediates=True,
         with_cuda=None,
-        with_sycl=None)
+        with_sycl=None,
+        object_cache_dir=objectCacheDir,
+        object_cache_base_dirs=objectCacheBaseDirs)
 
+    if objectCacheDir is not None:
+        maxSizeMB = int(os.environ.get('SLANGTORCH_OBJECT_CACHE_MAX_SIZE_MB', '5120'))
+        removed = trimObjectCache(objectCacheDir, maxSizeMB * 1024 * 1024)
+        if verbose and removed:
+            print(f"Removed {removed} entries from the object cache in {objectCacheDir}", file=sys.stderr)
 
-def parseDepfile(depFile):
+    return module
+
+
+def parseDepfile(depFile, contentHash=False):
     with open(depFile, 'r') as f:
         depFileContents = f.readlines()
 
@@ -677,14 +1504,211 @@ def parseDepfile(depFile):
 
         # Convert all depfiles to real paths.
         depFilesWithTimestamps = [
-            (depFile, os.path.getmtime(depFile)) for depFile in depFiles]
+            makeDependencyEntry(depFile, contentHash) for depFile in depFiles]
         
         allDepFiles.extend(depFilesWithTimestamps)
 
     return allDepFiles
 
 
-def _loadModule(fileName, moduleName, outputFolder, options, sourceDir=None, verbose=False, includePaths=[], dryRun=False, skipNinjaCheck=False, extraCudaFlags=[], extraSlangFlags=[]):
+def getIntermediateSourcePaths(fileName, outputFolder, sourceDir=None):
+    baseName = os.path.basename(fileName)
+    if sourceDir is None:
+        sourceDir = outputFolder
+
+    cppOutName = os.path.join(sourceDir, _replaceFileExt(baseName, ".cpp"))
+    cudaOutName = os.path.join(sourceDir, _replaceFileExt(baseName, "_cuda.cu"))
+    return cppOutName, cudaOutName
+
+
+def getVariantSourcePaths(fileName, outputFolder, index, sourceDir=None):
+    # Generated sources of one variant of a multi-variant module. The merged sources are at the 
+    # usual intermediate paths.
+    #
+    if sourceDir is None:
+        sourceDir = outputFolder
+    return getIntermediateSourcePaths(fileName, os.path.join(sourceDir, "variants", str(index)))
+
+
+def _getSlangOutputs(metadata, fileName, outputFolder, options, sourceDir=None):
+    # Returns (targetMetadata, options, outputFile) for every Slang output of a build.
+    if isinstance(options, VariantOptions):
+        variantsMetadata = metadata.get("variants") or []
+        outputs = []
+        for index, variantOptions in enumerate(options):
+            variantMetadata = variantsMetadata[index] if index < len(variantsMetadata) else {}
+            cppOutName, cudaOutName = getVariantSourcePaths(fileName, outputFolder, index, sourceDir)
+            outputs.append((variantMetadata.get("cpp", None), variantOptions, cppOutName))
+            outputs.append((variantMetadata.get("cuda", None), variantOptions, cudaOutName))
+        return outputs
+
+    cppOutName, cudaOutName = getIntermediateSourcePaths(fileName, outputFolder, sourceDir)
+    return [(metadata.get("cpp", None), options, cppOutName),
+            (metadata.get("cuda", None), options, cudaOutName)]
+
+
+def _tryLoadCachedModule(fileName, outputFolder, options, sourceDir=None, verbose=False, includePaths=[], skipNinjaCheck=False, metadata=None):
+    # Fast path for warm caches: validate the recorded fingerprints of every input (Slang 
+    # dependencies, generated sources, downstream headers) with plain stat calls, and load
+    # the existing binary if they all match. Never spawns slangc or ninja, and leaves
+    # metadata.json alone unless content hashing refreshed a timestamp.
+    # If metadata is given (from a published build), metadata.json is neither read nor written.
+    # Returns None if anything is out of date.
+    #
+    metadataFile = os.path.join(outputFolder, "metadata.json")
+    readOnly = metadata is not None
+    if not readOnly:
+        if not os.path.exists(metadataFile):
+            return None
+
+        try:
+            with open(metadataFile, 'r') as f:
+                metadata = json.load(f)
+        except (OSError, ValueError):
+            return None
+
+    if not metadata.get("moduleName") or not metadata.get("moduleBinary"):
+        return None
+
+    originalMetadata = json.dumps(metadata, sort_keys=True)
+
+    cppOutName, cudaOutName = getIntermediateSourcePaths(fileName, outputFolder, sourceDir)
+
+    for targetMetadata, targetOptions, outputFile in _getSlangOutputs(metadata, fileName, outputFolder, options, sourceDir):
+        if slangOutputNeedsRecompile(targetMetadata, targetOptions, outputFile, verbose, includePaths):
+            return None
+
+    try:
+        if moduleBinaryNeedsRebuild(metadata, [cppOutName, cudaOutName], verbose):
+            return None
+    except RuntimeError:
+        return None
+
+    if not skipNinjaCheck and downstreamDepsChanged(metadata, verbose):
+        return None
+
+    # Persist timestamps that were refreshed for touched-but-unchanged dependencies, so they
+    # don't have to be hashed again.
+    #
+    if not readOnly and json.dumps(metadata, sort_keys=True) != originalMetadata:
+        with open(metadataFile, 'w') as f:
+            json.dump(metadata, f, indent=4)
+
+    cacheLookupKey = metadata["moduleName"]
+    cachedModule = _getSessionCachedModule(cacheLookupKey, metadata["moduleBinary"])
+    if cachedModule is not None:
+        return cachedModule
+
+    try:
+        slangLib = _importModuleBinary(metadata["moduleName"], os.path.realpath(metadata["moduleBinary"]))
+    except Exception as e:
+        if verbose:
+            print(f"Failed to load existing module binary {metadata['moduleBinary']}: {e}", file=sys.stderr)
+        return None
+
+    compileAndLoadModule._moduleCache[cacheLookupKey] = slangLib
+    return slangLib
+
+
+# Build published for lock-free loads, in the options folder of a module. Written atomically
+# (under the module lock) after every successful load, and never modified in place.
+#
+PUBLISHED_BUILD_FILE = "published.json"
+
+def _getFileStat(path):
+    stat = os.stat(path)
+    return [stat.st_size, stat.st_mtime_ns]
+
+
+def _publishBuild(outputFolder, buildDir):
+    try:
+        with open(os.path.join(buildDir, "metadata.json"), 'r') as f:
+            metadata = json.load(f)
+        published = {
+            "version": versionCode,
+            "buildDir": os.path.basename(buildDir),
+            "binary": _getFileStat(os.path.realpath(metadata["moduleBinary"])),
+            "metadata": metadata,
+        }
+        publishedFile = os.path.join(outputFolder, PUBLISHED_BUILD_FILE)
+        tmpFile = f"{publishedFile}.{os.getpid()}.{uuid.uuid4().hex}.tmp"
+        with open(tmpFile, 'w') as f:
+            json.dump(published, f, indent=4)
+        os.replace(tmpFile, publishedFile)
+    except (OSError, ValueError, KeyError):
+        _unpublishBuild(outputFolder)
+
+
+def _unpublishBuild(outputFolder, buildDir=None):
+    # Removes the published build (only if it is buildDir, if given).
+    publishedFile = os.path.join(outputFolder, PUBLISHED_BUILD_FILE)
+    try:
+        if buildDir is not None:
+            with open(publishedFile, 'r') as f:
+                if json.load(f).get("buildDir") != os.path.basename(buildDir):
+                    return
+        os.remove(publishedFile)
+    except (OSError, ValueError):
+        pass
+
+
+def _tryLoadPublishedModule(fileName, outputFolder, options, verbose=False, includePaths=[], skipNinjaCheck=False):
+    # Lock-free path for cache hits. Validates the published build the same way as the locked
+    # fast path, but without taking the module lock, so that concurrent processes loading a 
+    # finished module don't serialize. Returns (rawModule, buildDir), or (None, None).
+    #
+    try:
+        with open(os.path.join(outputFolder, PUBLISHED_BUILD_FILE), 'r') as f:
+            published = json.load(f)
+        if published.get("version") != versionCode:
+            return None, None
+        buildDir = os.path.join(outputFolder, published["buildDir"])
+        metadata = published["metadata"]
+        moduleBinary = os.path.realpath(metadata["moduleBinary"])
+    except (OSError, ValueError, KeyError, TypeError):
+        return None, None
+
+    # Hold the build first, so that it isn't collected or rebuilt by another process, then 
+    # check that it's still the binary that was published.
+    #
+    with _sessionLock:
+        wasHeld = buildDir in BUILD_DIR_HOLDS
+        if not holdBuildDir(buildDir):
+            return None, None
+
+    rawModule = None
+    try:
+        if _getFileStat(moduleBinary) == published["binary"]:
+            rawModule = _tryLoadCachedModule(fileName, buildDir, options, sourceDir=outputFolder, verbose=verbose, 
+                                             includePaths=includePaths, skipNinjaCheck=skipNinjaCheck, metadata=metadata)
+    except OSError:
+        pass
+
+    if rawModule is None:
+        with _sessionLock:
+            if not wasHeld:
+                releaseBuildDir(buildDir)
+        return None, None
+    return rawModule, buildDir
+
+
+def _compileSlangModule(metadata, fileName, options, cppOutName, cudaOutName, verbose=False, includePaths=[], dryRun=False, extraSlangFlags=[], contentHash=False):
+    # Compiles a Slang file to its host and kernel sources, and records them in metadata. 
+    # Returns True if anything was (or, for a dry run, needs to be) recompiled.
+
+    # Both targets are compiled by concurrent slangc invocations.
+    result, targetMetadata = compileSlangTargets(
+        metadata, fileName,
+        [("cpp", "torch-binding", cppOutName), ("cuda", "cuda", cudaOutName)],
+        options, verbose, includePaths=includePaths, dryRun=dryRun,
+        extraSlangFlags=extraSlangFlags, contentHash=contentHash)
+    metadata["cpp"] = targetMetadata["cpp"]
+    metadata["cuda"] = targetMetadata["cuda"]
+
+    return result
+
+
+def _loadModule(fileName, moduleName, outputFolder, options, sourceDir=None, verbose=False, includePaths=[], dryRun=False, skipNinjaCheck=False, extraCudaFlags=[], extraSlangFlags=[], contentHash=False, globalCache=None, sharedPrelude=False, splitModule=False):
 
     # Try to find a metadata file "metadata.json" in outputFolder.
     metadataFile = os.path.join(outputFolder, "metadata.json")
@@ -693,28 +1717,46 @@ def _loadModule(fileName, moduleName, outputFolder, options, sourceDir=None, ver
         with open(metadataFile, 'r') as f:
             metadata = json.load(f)
 
-    baseName = os.path.basename(fileName)
     realFilePath = os.path.realpath(fileName)
     slangSourceDir = os.path.dirname(realFilePath) if realFilePath else None
 
-    if sourceDir is None:
-        cppOutName = os.path.join(outputFolder, _replaceFileExt(baseName, ".cpp"))
-        cudaOutName = os.path.join(outputFolder, _replaceFileExt(baseName, "_cuda.cu"))
-    else:
-        cppOutName = os.path.join(sourceDir, _replaceFileExt(baseName, ".cpp"))
-        cudaOutName = os.path.join(sourceDir, _replaceFileExt(baseName, "_cuda.cu"))
+    cppOutName, cudaOutName = getIntermediateSourcePaths(fileName, outputFolder, sourceDir)
 
     # Compile slang files to intermediate host and kernel modules.
     compileStartTime = time.perf_counter()
 
-    resultCpp, metadataCpp = compileSlang(metadata.get("cpp", None), fileName, "torch-binding", options, cppOutName, verbose, includePaths=includePaths, dryRun=dryRun, extraSlangFlags=extraSlangFlags)
-    metadata["cpp"] = metadataCpp
+    if isinstance(options, VariantOptions):
+        # Each variant is compiled to its own sources (concurrently), which are then merged.
+        variantsMetadata = metadata.get("variants") or []
+        variantsMetadata = [variantsMetadata[index] if index < len(variantsMetadata) else {} for index in range(len(options))]
 
-    resultCuda, metadataCuda = compileSlang(metadata.get("cuda", None), fileName, "cuda", options, cudaOutName, verbose, includePaths=includePaths, dryRun=dryRun, extraSlangFlags=extraSlangFlags)
-    metadata["cuda"] = metadataCuda
+        def compileVariant(index):
+            variantCppOutName, variantCudaOutName = getVariantSourcePaths(fileName, outputFolder, index, sourceDir)
+            os.makedirs(os.path.dirname(variantCppOutName), exist_ok=True)
+            return _compileSlangModule(
+                variantsMetadata[index], fileName, options[index], variantCppOutName, variantCudaOutName,
+                verbose, includePaths, dryRun, extraSlangFlags, contentHash)
 
-    if dryRun and (resultCuda or resultCpp):
-        return True
+        with concurrent.futures.ThreadPoolExecutor(max_workers=len(options)) as executor:
+            results = list(executor.map(compileVariant, range(len(options))))
+        result = any(results)
+        metadata["variants"] = variantsMetadata
+
+        if dryRun and result:
+            return True
+
+        if not dryRun:
+            mergeVariantSources(
+                [getVariantSourcePaths(fileName, outputFolder, index, sourceDir)[0] for index in range(len(options))],
+                [getVariantSourcePaths(fileName, outputFolder, index, sourceDir)[1] for index in range(len(options))],
+                cppOutName, cudaOutName)
+    else:
+        result = _compileSlangModule(
+            metadata, fileName, options, cppOutName, cudaOutName,
+            verbose, includePaths, dryRun, extraSlangFlags, contentHash)
+
+        if dryRun and result:
+            return True
 
     compileEndTime = time.perf_counter()
 
@@ -726,7 +1768,11 @@ def _loadModule(fileName, moduleName, outputFolder, options, sourceDir=None, ver
         moduleName, outputFolder, slangSourceDir,
         verbose, dryRun=dryRun, 
         skipNinjaCheck=skipNinjaCheck,
-        extraCudaFlags=extraCudaFlags)
+        extraCudaFlags=extraCudaFlags,
+        contentHash=contentHash,
+        globalCache=globalCache,
+        sharedPrelude=sharedPrelude,
+        splitModule=splitModule)
 
     if dryRun:
         if slangLib:
@@ -747,7 +1793,683 @@ def _loadModule(fileName, moduleName, outputFolder, options, sourceDir=None, ver
     return slangLib
 
 
-def loadModule(fileName, skipSlang=None, verbose=False, defines={}, includePaths=[], skipNinjaCheck=False, slangGenLineInfo=True, cudaFastMath=True, cudaGenLineInfo=True, extraSlangFlags=[], extraCudaFlags=[]):
+def loadModule(fileName, skipSlang=None, verbose=False, defines={}, includePaths=[], skipNinjaCheck=False, slangGenLineInfo=True, cudaFastMath=True, cudaGenLineInfo=True, extraSlangFlags=[], extraCudaFlags=[], contentHashDeps=None, globalCacheDir=None, watch=None, specializationConstants={}, specializeOnShapes=False):
+    r'''Builds (or loads from the cache) the Slang module fileName and returns it.
+
+        watch=True (or SLANGTORCH_WATCH=1) rebuilds the module in the background when its
+        sources change, see WatchedModule.
+
+        specializationConstants are passed to Slang like defines, but share one build directory
+        for all of their values. Changing a value only recompiles the generated sources that 
+        depend on it, and relinks.
+
+        specializeOnShapes=True builds variants of the module for the shapes its functions are
+        called with, see ShapeSpecializer. Kernels must opt in by reading the generated defines
+        where they are set:
+
+            #ifdef SLANGTORCH_SHAPE_input_0
+                uint size = SLANGTORCH_SHAPE_input_0;
+            #else
+                uint size = input.size(0);
+            #endif
+
+        If neither the module nor the files it imports mention SLANGTORCH_SHAPE_ or
+        SLANGTORCH_STRIDE_, no variants are built. It can't be combined with watch.
+    '''
+    # Watch mode can be enabled for all modules with SLANGTORCH_WATCH=1.
+    if watch is None:
+        watch = os.environ.get('SLANGTORCH_WATCH', '0') == '1'
+    if watch and specializeOnShapes:
+        raise ValueError(f"loadModule({fileName}): specializeOnShapes can't be combined with watch "
+                         "(watch=True or SLANGTORCH_WATCH=1)")
+
+    loadKwargs = dict(
+        skipSlang=skipSlang, verbose=verbose, defines=defines, includePaths=includePaths, 
+        skipNinjaCheck=skipNinjaCheck, slangGenLineInfo=slangGenLineInfo, cudaFastMath=cudaFastMath,
+        cudaGenLineInfo=cudaGenLineInfo, extraSlangFlags=extraSlangFlags, extraCudaFlags=extraCudaFlags,
+        contentHashDeps=contentHashDeps, globalCacheDir=globalCacheDir, specializationConstants=specializationConstants)
+    rawModule, buildDir = _loadRawModule(fileName, **loadKwargs)
+    recordModuleLoad(fileName, loadKwargs)
+
+    if watch:
+        return WatchedModule(fileName, loadKwargs, rawModule, buildDir)
+
+    if specializeOnShapes:
+        if usesShapeDefines(fileName, includePaths):
+            return wrapModule(rawModule, ShapeSpecializer(fileName, loadKwargs))
+        if verbose:
+            print(f"{fileName} doesn't use SLANGTORCH_SHAPE_ or SLANGTORCH_STRIDE_ defines, "
+                  "not specializing on shapes", file=sys.stderr)
+
+    return wrapModule(rawModule)
+
+
+def getShapeDefines(argnames, args):
+    r'''Returns the defines that describe the extents and strides of the tensors in args
+        (SLANGTORCH_SHAPE_<arg>_<dim> and SLANGTORCH_STRIDE_<arg>_<dim>). Tensors nested in 
+        structs are named <arg>_<field>.
+    '''
+    import torch
+    defines = {}
+
+    def visit(name, value):
+        if isinstance(value, torch.Tensor):
+            for dim, (size, stride) in enumerate(zip(value.shape, value.stride())):
+                defines[f"SLANGTORCH_SHAPE_{name}_{dim}"] = str(size)
+                defines[f"SLANGTORCH_STRIDE_{name}_{dim}"] = str(stride)
+        elif isinstance(value, dict):
+            for key, field in value.items():
+                visit(f"{name}_{convertNonAlphaNumericToUnderscore(str(key))}", field)
+        elif isinstance(value, tuple) and hasattr(value, "_fields"):
+            for key in value._fields:
+                visit(f"{name}_{key}", getattr(value, key))
+        elif isinstance(value, (tuple, list)):
+            for index, field in enumerate(value):
+                visit(f"{name}_{index}", field)
+
+    for argname, arg in zip(argnames, args):
+        visit(convertNonAlphaNumericToUnderscore(argname), arg)
+    return defines
+
+
+# 'import a.b_c;' and 'import "path/file.slang";' statements.
+_IMPORT_STATEMENT = re.compile(r'^\s*(?:__exported\s+)?import\s+(?:"([^"]+)"|([A-Za-z_][\w.]*))\s*;', re.MULTILINE)
+
+
+def findImportedFiles(fileName, includePaths=[]):
+    r'''Returns the source files directly imported by a Slang file, in import order. Imports
+        that can't be resolved (e.g. modules of the standard library) are left out.
+    '''
+    try:
+        with open(fileName, 'r') as f:
+            source = f.read()
+    except OSError:
+        return []
+
+    searchDirs = [os.path.dirname(os.path.realpath(fileName))] + list(includePaths or [])
+    importedFiles = []
+    for match in _IMPORT_STATEMENT.finditer(source):
+        if match.group(1) is not None:
+            candidates = [match.group(1)]
+        else:
+            # Slang maps the module name 'a.b_c' to the file 'a/b-c.slang'.
+            modulePath = match.group(2).replace('.', '/')
+            candidates = [modulePath.replace('_', '-') + ".slang", modulePath + ".slang"]
+
+        for searchDir in searchDirs:
+            path = next((os.path.realpath(os.path.join(searchDir, c)) for c in candidates 
+                         if os.path.isfile(os.path.join(searchDir, c))), None)
+            if path is not None:
+                if path not in importedFiles:
+                    importedFiles.append(path)
+                break
+
+    return importedFiles
+
+
+# '#include "file"' directives.
+_INCLUDE_DIRECTIVE = re.compile(r'^\s*#\s*include\s+"([^"]+)"', re.MULTILINE)
+
+_SHAPE_DEFINE = re.compile(r'\bSLANGTORCH_(?:SHAPE|STRIDE)_')
+
+
+def usesShapeDefines(fileName, includePaths=[]):
+    r'''Returns True if fileName, or a file it imports or includes, mentions the defines
+        generated by getShapeDefines.
+    '''
+    pending = [os.path.realpath(fileName)]
+    visited = set()
+    while pending:
+        path = pending.pop()
+        if path in visited:
+            continue
+        visited.add(path)
+        try:
+            with open(path, 'r') as f:
+                source = f.read()
+        except OSError:
+            continue
+        if _SHAPE_DEFINE.search(source):
+            return True
+
+        pending.extend(findImportedFiles(path, includePaths))
+        searchDirs = [os.path.dirname(path)] + list(includePaths or [])
+        for match in _INCLUDE_DIRECTIVE.finditer(source):
+            for searchDir in searchDirs:
+                includeFile = os.path.join(searchDir, match.group(1))
+                if os.path.isfile(includeFile):
+                    pending.append(os.path.realpath(includeFile))
+                    break
+    return False
+
+
+class ShapeSpecializer(object):
+    r'''Routes the calls of a module loaded with specializeOnShapes=True to builds specialized
+        for the shapes of their tensor arguments.
+
+        The first call of a function with new shapes starts a build of the module in the 
+        background, with the extents and strides of its tensors as defines (see getShapeDefines)
+        and SLANGTORCH_SPECIALIZED_SHAPES=1. Kernels opt in by using those defines where they 
+        are set, e.g. '#ifdef SLANGTORCH_SHAPE_input_0'. Calls use the generic build until the
+        specialized one is ready, and for shapes beyond the first SLANGTORCH_MAX_SHAPE_VARIANTS 
+        (default 8). Failed builds are reported once, and the generic build is kept.
+    '''
+    def __init__(self, fileName, loadKwargs, maxVariants=None) -> None:
+        self._fileName = fileName
+        self._loadKwargs = dict(loadKwargs)
+        self._loadKwargs["defines"] = dict(loadKwargs.get("defines") or {})
+        if maxVariants is None:
+            maxVariants = int(os.environ.get('SLANGTORCH_MAX_SHAPE_VARIANTS', '8'))
+        self._maxVariants = maxVariants
+        self._variants = {}
+        self._lock = threading.Lock()
+
+    def _load(self, defines):
+        kwargs = dict(self._loadKwargs, defines=defines)
+        rawModule, _ = _loadRawModule(self._fileName, **kwargs)
+        recordModuleLoad(self._fileName, kwargs)
+        return rawModule
+
+    def getFunction(self, fnName, argnames, args):
+        r'''Returns the specialized build of function fnName for args, or None if there is none (yet).'''
+        shapeDefines = getShapeDefines(argnames, args)
+        if not shapeDefines:
+            return None
+
+        key = (fnName, tuple(sorted(shapeDefines.items())))
+        with self._lock:
+            future = self._variants.get(key)
+            if future is None:
+                if len(self._variants) >= self._maxVariants:
+                    return None
+                if self._loadKwargs.get("verbose"):
+                    print(f"Building {fnName} of {self._fileName} specialized for shapes {shapeDefines}", file=sys.stderr)
+                defines = {**self._loadKwargs["defines"], "SLANGTORCH_SPECIALIZED_SHAPES": "1", **shapeDefines}
+                future = getBuildPool().submit(self._load, defines)
+                self._variants[key] = future
+
+        if not future.done():
+            return None
+
+        if future.exception() is not None:
+            with self._lock:
+                if self._variants.get(key) is future:
+                    # Keep the failed entry (so it isn't built again), but report it once.
+                    self._variants[key] = concurrent.futures.Future()
+                    self._variants[key].set_result(None)
+                    print(f"Failed to build {fnName} of {self._fileName} specialized for shapes, "
+                          f"using the generic build: {future.exception()}", file=sys.stderr)
+            return None
+
+        rawModule = future.result()
+        return getattr(rawModule, fnName, None) if rawModule is not None else None
+
+
+# Arguments of loadModule that determine what is built, and are recorded in warm-up manifests.
+WARMUP_ARGUMENTS = ["defines", "includePaths", "slangGenLineInfo", "cudaFastMath", "cudaGenLineInfo", "extraSlangFlags", "extraCudaFlags", "specializationConstants"]
+
+_recordedLoads = set()
+_pendingRecordedLoads = {}
+
+def recordModuleLoad(fileName, loadKwargs):
+    # With SLANGTORCH_RECORD_MANIFEST set, every successful load is added to that warm-up 
+    # manifest (see warmupModules). Paths are recorded as absolute paths, resolved against the
+    # current working directory. New entries are written to the manifest once, at exit.
+    #
+    manifestFile = os.environ.get('SLANGTORCH_RECORD_MANIFEST', None)
+    if not manifestFile:
+        return
+
+    entry = {"fileName": os.path.abspath(fileName)}
+    for name in WARMUP_ARGUMENTS:
+        value = loadKwargs.get(name)
+        entry[name] = dict(value) if isinstance(value, dict) else (list(value) if isinstance(value, list) else value)
+    if entry.get("includePaths"):
+        entry["includePaths"] = [os.path.abspath(path) for path in entry["includePaths"]]
+
+    entryKey = json.dumps(entry, sort_keys=True)
+    manifestFile = os.path.abspath(manifestFile)
+    with _sessionLock:
+        if (manifestFile, entryKey) in _recordedLoads:
+            return
+        _recordedLoads.add((manifestFile, entryKey))
+        _pendingRecordedLoads.setdefault(manifestFile, []).append(entry)
+
+
+@atexit.register
+def flushRecordedLoads():
+    r'''Adds the loads recorded since the last flush to their warm-up manifests. Runs at exit.'''
+    with _sessionLock:
+        pending = dict(_pendingRecordedLoads)
+        _pendingRecordedLoads.clear()
+
+    for manifestFile, entries in pending.items():
+        with FileLock(manifestFile + ".lock"):
+            manifest = {"version": 1, "modules": []}
+            if os.path.exists(manifestFile):
+                with open(manifestFile, 'r') as f:
+                    manifest = json.load(f)
+
+            existingKeys = set(json.dumps(m, sort_keys=True) for m in manifest["modules"])
+            newEntries = [entry for entry in entries if json.dumps(entry, sort_keys=True) not in existingKeys]
+            if not newEntries:
+                continue
+            manifest["modules"].extend(newEntries)
+
+            tmpFile = f"{manifestFile}.{os.getpid()}.tmp"
+            with open(tmpFile, 'w') as f:
+                json.dump(manifest, f, indent=4)
+            os.replace(tmpFile, manifestFile)
+
+
+def readWarmupManifest(manifestFile):
+    r'''Returns the module entries of a warm-up manifest:
+
+        {"version": 1, "modules": [{"fileName": "kernels/foo.slang", "defines": {"N": 4}, ...}]}
+
+        Entries may leave out any loadModule argument. Relative file names and include paths
+        are resolved against "cwd", which defaults to the directory of the manifest. The 
+        returned entries only have absolute paths.
+    '''
+    with open(manifestFile, 'r') as f:
+        manifest = json.load(f)
+
+    manifestDir = os.path.dirname(os.path.abspath(manifestFile))
+    entries = []
+    for entry in manifest.get("modules", []):
+        entry = dict(entry)
+        cwd = os.path.join(manifestDir, entry.get("cwd", manifestDir))
+        entry["fileName"] = os.path.normpath(os.path.join(cwd, entry["fileName"]))
+        if entry.get("includePaths"):
+            entry["includePaths"] = [os.path.normpath(os.path.join(cwd, path)) for path in entry["includePaths"]]
+        entries.append(entry)
+    return entries
+
+
+def warmupModules(manifestFile, globalCacheDir=None, verbose=False):
+    r'''Builds every module variant listed in a warm-up manifest, in parallel (using the
+        compiler job budget), into the usual .slangtorch_cache locations and optionally a
+        global cache. Returns a list of (entry, exception) for the modules that failed.
+    '''
+    entries = readWarmupManifest(manifestFile)
+
+    # Paths are absolute, so the working directory of this process doesn't matter.
+    futures = []
+    for entry in entries:
+        kwargs = dict((name, entry[name]) for name in WARMUP_ARGUMENTS if entry.get(name) is not None)
+        futures.append((entry, getBuildPool().submit(
+            _loadRawModule, entry["fileName"], verbose=verbose, globalCacheDir=globalCacheDir, **kwargs)))
+
+    failures = []
+    for entry, future in futures:
+        exception = future.exception()
+        if exception is not None:
+            failures.append((entry, exception))
+            print(f"Failed to build {entry['fileName']} (defines: {entry.get('defines') or {}}): {exception}", file=sys.stderr)
+        elif verbose:
+            print(f"Built {entry['fileName']} (defines: {entry.get('defines') or {}})", file=sys.stderr)
+
+    return failures
+
+
+def getWatchedFiles(fileName, buildDir, includePaths=[]):
+    # The Slang sources (including imported modules) as recorded for the build, and the headers
+    # of the generated sources that are in the source directory or the include paths. The torch,
+    # CUDA and system headers are left out, they would only add watches for edits that don't 
+    # happen.
+    #
+    paths = set([os.path.realpath(fileName)])
+    try:
+        with open(os.path.join(buildDir, "metadata.json"), 'r') as f:
+            metadata = json.load(f)
+    except (OSError, ValueError):
+        return paths
+
+    for key in ("cpp", "cuda"):
+        paths.update(dep[0] for dep in (metadata.get(key) or {}).get("deps", []))
+
+    headerDirs = [os.path.dirname(os.path.realpath(fileName))] + [os.path.realpath(path) for path in includePaths or []]
+    for dep in metadata.get("downstreamDeps") or []:
+        depPath = os.path.realpath(dep[0])
+        if any(depPath.startswith(os.path.join(headerDir, '')) for headerDir in headerDirs):
+            paths.add(dep[0])
+    return paths
+
+
+class WatchedModule(object):
+    r'''Module returned by loadModule(..., watch=True). Rebuilds the module on a background
+        thread when one of its sources or headers changes, and switches to the new module on
+        the next attribute access. Failed rebuilds are reported, and the current module is
+        kept.
+    '''
+    def __init__(self, fileName, loadKwargs, rawModule, buildDir) -> None:
+        self._fileName = fileName
+        self._loadKwargs = dict(loadKwargs,
+            defines=dict(loadKwargs['defines'] or {}), includePaths=list(loadKwargs['includePaths'] or []),
+            extraSlangFlags=list(loadKwargs['extraSlangFlags'] or []), extraCudaFlags=list(loadKwargs['extraCudaFlags'] or []))
+        self._rawModule = rawModule
+        self._module = wrapModule(rawModule)
+        self._pendingModule = None
+        self._lock = threading.Lock()
+        self._rebuilt = threading.Condition(self._lock)
+        self._rebuildCount = 0
+        self._watcher = FileWatcher(getWatchedFiles(fileName, buildDir, self._loadKwargs['includePaths']), self._onChange)
+
+    def _onChange(self, changedPaths):
+        verbose = self._loadKwargs['verbose']
+        if verbose:
+            print(f"Rebuilding {self._fileName}, changed: {', '.join(sorted(changedPaths))}", file=sys.stderr)
+
+        buildDir = None
+        newModule = None
+        try:
+            rawModule, buildDir = _loadRawModule(self._fileName, **self._loadKwargs)
+            if rawModule is not self._rawModule:
+                newModule = wrapModule(rawModule)
+        except Exception as e:
+            print(f"Failed to rebuild {self._fileName}, keeping the current module: {e}", file=sys.stderr)
+
+        with self._lock:
+            if newModule is not None:
+                self._rawModule = rawModule
+                self._pendingModule = newModule
+            self._rebuildCount += 1
+            self._rebuilt.notify_all()
+
+        # The set of dependencies may have changed. After a failed build, keep the current one.
+        return getWatchedFiles(self._fileName, buildDir, self._loadKwargs['includePaths']) if buildDir is not None else None
+
+    def __getattr__(self, name):
+        # Only called for names that aren't attributes of the watcher itself.
+        if name.startswith('__') or '_module' not in self.__dict__:
+            raise AttributeError(name)
+
+        if self._pendingModule is not None:
+            with self._lock:
+                if self._pendingModule is not None:
+                    self._module = self._pendingModule
+                    self._pendingModule = None
+
+        return getattr(self._module, name)
+
+    def __dir__(self):
+        return sorted(set(dir(self._module)) | set(object.__dir__(self)))
+
+    def waitForRebuild(self, timeout=None):
+        r'''Waits for the next rebuild attempt to finish. Returns False on timeout.'''
+        with self._lock:
+            rebuildCount = self._rebuildCount
+            return self._rebuilt.wait_for(lambda: self._rebuildCount != rebuildCount, timeout)
+
+    def stopWatching(self):
+        self._watcher.stop()
+
+
+# Thread pool that builds modules for loadModuleAsync. Created on first use.
+_buildPool = None
+
+def getBuildPool():
+    global _buildPool
+    with _sessionLock:
+        if _buildPool is None:
+            # Builds mostly wait on slangc, ninja and the compilers, so a few threads are enough
+            # to overlap them.
+            #
+            maxWorkers = int(os.environ.get('SLANGTORCH_BUILD_THREADS', '0')) or min(8, os.cpu_count() or 1)
+            _buildPool = concurrent.futures.ThreadPoolExecutor(
+                max_workers=maxWorkers, thread_name_prefix="slangtorch-build")
+        return _buildPool
+
+
+class ModuleFuture(object):
+    r'''Result of loadModuleAsync. The module is built and imported in the background, and 
+        wrapped by the first call to result().
+    '''
+    def __init__(self, future) -> None:
+        self._future = future
+        self._module = None
+        self._lock = threading.Lock()
+
+    def done(self):
+        return self._future.done()
+
+    def cancel(self):
+        return self._future.cancel()
+
+    def exception(self, timeout=None):
+        return self._future.exception(timeout)
+
+    def add_done_callback(self, fn):
+        self._future.add_done_callback(lambda _: fn(self))
+
+    def result(self, timeout=None):
+        rawModule = self._future.result(timeout)
+        with self._lock:
+            if self._module is None:
+                self._module = wrapModule(rawModule)
+            return self._module
+
+
+def loadModuleAsync(fileName, skipSlang=None, verbose=False, defines={}, includePaths=[], skipNinjaCheck=False, slangGenLineInfo=True, cudaFastMath=True, cudaGenLineInfo=True, extraSlangFlags=[], extraCudaFlags=[], contentHashDeps=None, globalCacheDir=None, specializationConstants={}):
+    r'''Same as loadModule, but builds and imports the module on a background thread and 
+        returns a ModuleFuture. Loads of different modules run concurrently, loads of the 
+        same module are serialized by its lock as usual.
+    '''
+    # Copy the arguments now, the caller may change them before the build starts.
+    kwargs = dict(
+        skipSlang=skipSlang, verbose=verbose, defines=dict(defines) if defines else {}, 
+        includePaths=list(includePaths) if includePaths else [], skipNinjaCheck=skipNinjaCheck,
+        slangGenLineInfo=slangGenLineInfo, cudaFastMath=cudaFastMath, cudaGenLineInfo=cudaGenLineInfo,
+        extraSlangFlags=list(extraSlangFlags) if extraSlangFlags else [],
+        extraCudaFlags=list(extraCudaFlags) if extraCudaFlags else [],
+        contentHashDeps=contentHashDeps, globalCacheDir=globalCacheDir,
+        specializationConstants=dict(specializationConstants) if specializationConstants else {})
+
+    def load():
+        rawModule, _ = _loadRawModule(fileName, **kwargs)
+        recordModuleLoad(fileName, kwargs)
+        return rawModule
+
+    return ModuleFuture(getBuildPool().submit(load))
+
+
+def loadModules(modules, **kwargs):
+    r'''Loads several modules concurrently, and returns them in the same order.
+
+        Each entry of modules is either a file name, or a dict with a 'fileName' and any other
+        loadModule arguments for that module. The remaining keyword arguments are passed to 
+        loadModule for every module.
+
+        All builds draw their compiler processes from one process-wide job budget (see 
+        util/jobs.py), so that building many modules at once neither oversubscribes the 
+        machine nor runs out of memory. If any module fails to load, the first error is 
+        raised once all loads have finished.
+    '''
+    futures = []
+    for module in modules:
+        moduleKwargs = dict(kwargs)
+        if isinstance(module, dict):
+            moduleKwargs.update(module)
+        else:
+            moduleKwargs['fileName'] = module
+        futures.append(loadModuleAsync(**moduleKwargs))
+
+    concurrent.futures.wait([future._future for future in futures])
+    return [future.result() for future in futures]
+
+
+def loadModuleVariants(fileName, variants, verbose=False, defines={}, includePaths=[], skipNinjaCheck=False, slangGenLineInfo=True, cudaFastMath=True, cudaGenLineInfo=True, extraSlangFlags=[], extraCudaFlags=[], contentHashDeps=None, globalCacheDir=None):
+    r'''Builds several variants of a Slang module into a single extension module, and returns one
+        module per variant, in the same order.
+
+        Each entry of variants is a dict of defines, applied on top of 'defines'. The variants
+        are compiled by Slang separately, and their generated sources are merged (see 
+        util/variants.py), so the host and CUDA sources are compiled and linked once for the
+        whole set instead of once per variant. Changing the set of variants rebuilds all of them.
+    '''
+    if not variants:
+        raise ValueError("loadModuleVariants requires at least one variant")
+
+    rawModule, _ = _loadRawModule(
+        fileName, verbose=verbose, defines=defines, includePaths=includePaths, skipNinjaCheck=skipNinjaCheck,
+        slangGenLineInfo=slangGenLineInfo, cudaFastMath=cudaFastMath, cudaGenLineInfo=cudaGenLineInfo,
+        extraSlangFlags=extraSlangFlags, extraCudaFlags=extraCudaFlags, contentHashDeps=contentHashDeps,
+        globalCacheDir=globalCacheDir, variants=variants)
+
+    return [wrapModule(getattr(rawModule, VARIANT_SUBMODULE.format(index))) for index in range(len(variants))]
+
+
+def getAutotuneDatabasePath():
+    # Per user, like the other caches that aren't tied to a source directory (the package 
+    # directory may be read-only or shared).
+    #
+    return os.environ.get('SLANGTORCH_AUTOTUNE_DB', os.path.join(getUserCacheDir(), "autotune.json"))
+
+
+def getMachineFingerprint():
+    r'''Identity of the hardware (and the CUDA/torch versions) that tuning results apply to.'''
+    import platform
+    import torch
+
+    fingerprint = {
+        "machine": platform.machine(),
+        "processor": platform.processor(),
+        "cpuCount": os.cpu_count(),
+        "torch": torch.__version__,
+        "cuda": torch.version.cuda,
+    }
+    if torch.cuda.is_available():
+        props = torch.cuda.get_device_properties(torch.cuda.current_device())
+        fingerprint["device"] = [props.name, props.major, props.minor, props.multi_processor_count, props.total_memory]
+    return fingerprint
+
+
+def _expandSearchSpace(searchSpace):
+    # A dict of value lists is expanded to all combinations, a list is taken as the candidates.
+    if isinstance(searchSpace, dict):
+        import itertools
+        names = list(searchSpace.keys())
+        return [dict(zip(names, values)) for values in itertools.product(*(searchSpace[name] for name in names))]
+    return [dict(candidate) for candidate in searchSpace]
+
+
+def _timeCandidate(module, config, benchmarkFn, warmup, repeat):
+    import torch
+    synchronize = torch.cuda.synchronize if torch.cuda.is_available() else (lambda: None)
+
+    for _ in range(warmup):
+        benchmarkFn(module, config)
+    synchronize()
+
+    times = []
+    for _ in range(repeat):
+        startTime = time.perf_counter()
+        benchmarkFn(module, config)
+        synchronize()
+        times.append(time.perf_counter() - startTime)
+    return sorted(times)[len(times) // 2]
+
+
+def autotune(fileName, searchSpace, benchmarkFn, warmup=1, repeat=5, database=None, retune=False, verbose=False, defines={}, **kwargs):
+    r'''Picks the fastest variant of a module on this machine. Returns (module, config).
+
+        searchSpace is either a dict of {name: [values]}, whose combinations are the candidates,
+        or a list of candidate dicts. Every entry of a candidate is passed as a define (on top of
+        'defines'). The candidates are built concurrently through loadModule's cache, then 
+        benchmarkFn(module, config) is timed for each (median of 'repeat' runs, after 'warmup' 
+        runs). benchmarkFn should run the kernels on representative inputs, using config for 
+        anything that isn't a define (e.g. the block size of a launch).
+
+        The winner is stored in the tuning database (a JSON file, SLANGTORCH_AUTOTUNE_DB by 
+        default), keyed by the module, the search space and the machine (getMachineFingerprint).
+        Later calls load the stored winner without benchmarking, unless retune is set. Candidates
+        that fail to build or run are skipped. The remaining keyword arguments are passed to 
+        loadModuleAsync.
+    '''
+    candidates = _expandSearchSpace(searchSpace)
+    if not candidates:
+        raise ValueError("autotune requires at least one candidate")
+
+    if database is None:
+        database = getAutotuneDatabasePath()
+    database = os.path.abspath(database)
+
+    tuningKey = getHash([
+        os.path.realpath(fileName), candidates, dict(defines or {}),
+        dict((name, value) for name, value in kwargs.items() if name in WARMUP_ARGUMENTS),
+        getMachineFingerprint()], truncate_at=32)
+
+    def candidateDefines(config):
+        return {**dict(defines or {}), **dict((name, str(value)) for name, value in config.items())}
+
+    if not retune and os.path.exists(database):
+        try:
+            with open(database, 'r') as f:
+                entry = json.load(f).get("entries", {}).get(tuningKey)
+        except (OSError, ValueError):
+            entry = None
+        if entry is not None and entry.get("config") in candidates:
+            config = entry["config"]
+            if verbose:
+                print(f"Using tuned configuration {config} for {fileName}", file=sys.stderr)
+            return loadModule(fileName, verbose=verbose, defines=candidateDefines(config), **kwargs), config
+
+    futures = [loadModuleAsync(fileName, verbose=verbose, defines=candidateDefines(config), **kwargs) for config in candidates]
+
+    results = []
+    for config, future in zip(candidates, futures):
+        try:
+            module = future.result()
+        except Exception as e:
+            print(f"Skipping candidate {config} of {fileName}, it failed to build: {e}", file=sys.stderr)
+            continue
+
+        try:
+            elapsed = _timeCandidate(module, config, benchmarkFn, warmup, repeat)
+        except Exception as e:
+            print(f"Skipping candidate {config} of {fileName}, it failed to run: {e}", file=sys.stderr)
+            continue
+
+        if verbose:
+            print(f"Candidate {config}: {elapsed * 1000:.3f} ms", file=sys.stderr)
+        results.append((elapsed, config, module))
+
+    if not results:
+        raise RuntimeError(f"None of the {len(candidates)} candidates of {fileName} could be benchmarked")
+
+    elapsed, config, module = min(results, key=lambda result: result[0])
+    if verbose:
+        print(f"Tuned configuration for {fileName}: {config} ({elapsed * 1000:.3f} ms)", file=sys.stderr)
+
+    os.makedirs(os.path.dirname(database), exist_ok=True)
+    with FileLock(database + ".lock"):
+        contents = {"version": 1, "entries": {}}
+        if os.path.exists(database):
+            try:
+                with open(database, 'r') as f:
+                    contents = json.load(f)
+            except (OSError, ValueError):
+                pass
+        contents.setdefault("entries", {})[tuningKey] = {
+            "fileName": os.path.realpath(fileName),
+            "config": config,
+            "timings": [[result[1], result[0]] for result in results],
+        }
+        tmpFile = f"{database}.{os.getpid()}.tmp"
+        with open(tmpFile, 'w') as f:
+            json.dump(contents, f, indent=4)
+        os.replace(tmpFile, database)
+
+    return module, config
+
+
+def _loadRawModule(fileName, skipSlang=None, verbose=False, defines={}, includePaths=[], skipNinjaCheck=False, slangGenLineInfo=True, cudaFastMath=True, cudaGenLineInfo=True, extraSlangFlags=[], extraCudaFlags=[], contentHashDeps=None, globalCacheDir=None, variants=None, specializationConstants={}, sharedPrelude=None):
+    # Returns the unwrapped module, and the build directory it was loaded from. With variants 
+    # (see loadModuleVariants), the module has a submodule per variant.
+
+    if not slangcAvailable:
+        raise RuntimeError(f"Could not find slangc executable at {slangcPath}")
+
     # Print warning
     if skipSlang is not None:
         print("Warning: skipSlang is deprecated in favor of a dependency-based cache.", file=sys.stderr)
@@ -756,14 +2478,32 @@ def loadModule(fileName, skipSlang=None, verbose=False, defines={}, includePaths
         print(f"Loading slang module: {fileName}", file=sys.stderr)
         print(f"Using slangc location: {slangcPath}", file=sys.stderr)
 
-    if not defines:
-        defines = {}
-    
-    if not extraCudaFlags:
-        extraCudaFlags = []
-    
-    if not extraSlangFlags:
-        extraSlangFlags = []
+    # The cache location derives from the directory of the file. Relative paths are resolved
+    # against the working directory here, so the same module has one cache location however
+    # it is named.
+    #
+    fileName = os.path.abspath(fileName)
+    includePaths = [os.path.abspath(path) for path in includePaths] if includePaths else []
+
+    # Copy the arguments, the flags are extended below and may be shared with other loads.
+    defines = dict(defines) if defines else {}
+    specializationConstants = dict(specializationConstants) if specializationConstants else {}
+    extraCudaFlags = list(extraCudaFlags) if extraCudaFlags else []
+    extraSlangFlags = list(extraSlangFlags) if extraSlangFlags else []
+
+    # Content hashing of dependencies can be enabled per call, or for the whole process
+    # with SLANGTORCH_CONTENT_HASH_DEPS=1
+    #
+    if contentHashDeps is None:
+        contentHashDeps = os.environ.get('SLANGTORCH_CONTENT_HASH_DEPS', '0') == '1'
+    assert(isinstance(contentHashDeps, bool))
+
+    # Builds can be shared across source directories through a global cache, enabled per call
+    # or with SLANGTORCH_GLOBAL_CACHE_DIR
+    #
+    if globalCacheDir is None:
+        globalCacheDir = os.environ.get('SLANGTORCH_GLOBAL_CACHE_DIR', None)
+    globalCache = getGlobalBuildCache(globalCacheDir)
 
     assert(isinstance(cudaFastMath, bool))    
     if cudaFastMath:
@@ -787,21 +2527,76 @@ def loadModule(fileName, skipSlang=None, verbose=False, defines={}, includePaths
     parentFolder = os.path.dirname(fileName)
 
     # We'll include the parent folder in the hash to distinguish between files with the same name in different folders.
-    optionsHash = getHash([defines, extraCudaFlags, extraSlangFlags, parentFolder], truncate_at=16)
+    # Modules linked against the shared prelude library are kept apart from self-contained ones.
+    #
+    # Link against the shared prelude library (SLANGTORCH_SHARED_PRELUDE unless set per call).
+    if sharedPrelude is None:
+        sharedPrelude = useSharedPreludeLibrary()
+    sharedPrelude = bool(sharedPrelude) and sys.platform.startswith("linux")
+
+    hashInputs = [defines, extraCudaFlags, extraSlangFlags, parentFolder]
+    if sharedPrelude:
+        hashInputs.append("sharedPrelude")
+    if variants is not None:
+        variantDefines = [{**defines, **dict(variant)} for variant in variants]
+        hashInputs.append(["variants", variantDefines])
+
+    # Specialization constants are passed to Slang like defines, but only their names select
+    # the build directory. Changing a value rebuilds the latest build incrementally: Slang 
+    # regenerates the sources, and only those whose contents changed are replaced. The module
+    # definition is split from the host source (see splitModuleDefinition), so that a build
+    # cloned for a new build ID recompiles the sources that changed and relinks, instead of 
+    # recompiling everything for the new module name.
+    #
+    if specializationConstants:
+        hashInputs.append(["specializationConstants", sorted(specializationConstants)])
+        defines = {**defines, **specializationConstants}
+        if variants is not None:
+            variantDefines = [{**variant, **specializationConstants} for variant in variantDefines]
+    optionsHash = getHash(hashInputs, truncate_at=16)
     
     baseNameWoExt = os.path.splitext(os.path.basename(fileName))[0]
     baseOutputFolder = os.path.join(parentFolder, ".slangtorch_cache", baseNameWoExt)
     outputFolder = os.path.join(baseOutputFolder, optionsHash)
 
+    # Common options
+    if variants is not None:
+        options = VariantOptions(makeOptionsList(variant) for variant in variantDefines)
+    else:
+        options = makeOptionsList(defines)
+
+    # Cache hits don't need the module lock.
+    rawModule, buildDir = _tryLoadPublishedModule(fileName, outputFolder, options, verbose=verbose, includePaths=includePaths, skipNinjaCheck=skipNinjaCheck)
+    if rawModule is not None:
+        if verbose:
+            print(f"Cache hit. Using published build in {buildDir}", file=sys.stderr)
+        _countCacheLookup("hits")
+        addLoadedDirectoryEntry(outputFolder, buildDir)
+        return rawModule, buildDir
+
+    # One process builds, the others wait for it to finish (blocking, without polling) and load
+    # the build it published. They only build themselves if it didn't publish a usable build.
+    #
     lockFile = os.path.join(parentFolder, os.path.basename(fileName) + optionsHash + ".lock")
-    with FileLock(lockFile):
+    buildLock = BuildLock(lockFile)
+    while not buildLock.tryAcquire():
+        if verbose:
+            print(f"Waiting for another process to build {fileName}", file=sys.stderr)
+        buildLock.waitForRelease()
+
+        rawModule, buildDir = _tryLoadPublishedModule(fileName, outputFolder, options, verbose=verbose, includePaths=includePaths, skipNinjaCheck=skipNinjaCheck)
+        if rawModule is not None:
+            if verbose:
+                print(f"Using build published by another process in {buildDir}", file=sys.stderr)
+            _countCacheLookup("hits")
+            addLoadedDirectoryEntry(outputFolder, buildDir)
+            return rawModule, buildDir
+
+    with buildLock:
         # Specialize output folder with hash of the specialization parameters
 
         if not os.path.exists(outputFolder):
             os.makedirs(outputFolder)
-        
-        # Common options
-        options = makeOptionsList(defines)
 
         # Module name
         moduleName = f"_slangtorch_{convertNonAlphaNumericToUnderscore(baseNameWoExt)}_{optionsHash}"
@@ -809,11 +2604,23 @@ def loadModule(fileName, skipSlang=None, verbose=False, defines={}, includePaths
         # Dry run with latest build dir
         buildDir, buildID = getLatestDir(outputFolder, outputFolder)
 
+        if buildDir is not None:
+            rawModule = _tryLoadCachedModule(fileName, buildDir, options, sourceDir=outputFolder, verbose=verbose, includePaths=includePaths, skipNinjaCheck=skipNinjaCheck)
+            if rawModule is not None:
+                if verbose:
+                    print(f"Cache hit. Using existing build in {buildDir}", file=sys.stderr)
+                _countCacheLookup("hits")
+                addLoadedDirectoryEntry(outputFolder, buildDir)
+                _publishBuild(outputFolder, buildDir)
+                return rawModule, buildDir
+
+        _countCacheLookup("misses")
+
         if buildDir is not None:
             if verbose:
                 print(f"Dry-run using latest build directory: {buildDir}", file=sys.stderr)
 
-            needsRecompile = _loadModule(fileName, f"{moduleName}_{buildID}", buildDir, options, sourceDir=outputFolder, verbose=verbose, includePaths=includePaths, dryRun=True, skipNinjaCheck=skipNinjaCheck, extraCudaFlags=extraCudaFlags, extraSlangFlags=extraSlangFlags)
+            needsRecompile = _loadModule(fileName, f"{moduleName}_{buildID}", buildDir, options, sourceDir=outputFolder, verbose=verbose, includePaths=includePaths, dryRun=True, skipNinjaCheck=skipNinjaCheck, extraCudaFlags=extraCudaFlags, extraSlangFlags=extraSlangFlags, contentHash=contentHashDeps, globalCache=globalCache, sharedPrelude=sharedPrelude, splitModule=bool(specializationConstants))
         else:
             if verbose:
                 print(f"No latest build directory.", file=sys.stderr)
@@ -824,17 +2631,188 @@ def loadModule(fileName, skipSlang=None, verbose=False, defines={}, includePaths
             if verbose:
                 print("Build required. Creating unique build directory", file=sys.stderr)
             # Handle versioning
-            buildDir, buildID = getOrCreateUniqueDir(outputFolder, outputFolder)
+            buildDir, buildID = getOrCreateUniqueDir(outputFolder, outputFolder, verbose=verbose)
+
+            # The directory may be the published one (if no process holds it). Stop lock-free
+            # loads from using it before it is rebuilt.
+            #
+            _unpublishBuild(outputFolder, buildDir)
         else:
             buildDir = buildDir
         
         if verbose:
             print(f"Working folder: {buildDir}", file=sys.stderr)
 
-        rawModule = _loadModule(fileName, f"{moduleName}_{buildID}", buildDir, options, sourceDir=outputFolder, verbose=verbose, includePaths=includePaths, dryRun=False, skipNinjaCheck=skipNinjaCheck, extraCudaFlags=extraCudaFlags, extraSlangFlags=extraSlangFlags)
+        rawModule = _loadModule(fileName, f"{moduleName}_{buildID}", buildDir, options, sourceDir=outputFolder, verbose=verbose, includePaths=includePaths, dryRun=False, skipNinjaCheck=skipNinjaCheck, extraCudaFlags=extraCudaFlags, extraSlangFlags=extraSlangFlags, contentHash=contentHashDeps, globalCache=globalCache, sharedPrelude=sharedPrelude, splitModule=bool(specializationConstants))
         addLoadedDirectoryEntry(outputFolder, buildDir)
+        _publishBuild(outputFolder, buildDir)
 
-    return wrapModule(rawModule)
+        # A new build directory was allocated, so old ones may have become stale.
+        keepBuilds = getKeepBuildsCount()
+        if needsRecompile and keepBuilds > 0:
+            try:
+                _collectStaleBuildDirs(outputFolder, keepBuilds, verbose=verbose)
+            except OSError as e:
+                if verbose:
+                    print(f"Failed to collect stale build directories in {outputFolder}: {e}", file=sys.stderr)
+
+    return rawModule, buildDir
+
+
+def getCacheStats():
+    return dict(CACHE_STATS)
+
+
+def collectStaleBuildDirs(path, keep=None, verbose=False):
+    r'''Removes stale build directories of a Slang module, or of every module cached in a directory.
+        Keeps the 'keep' most recently used builds per set of options (SLANGTORCH_KEEP_BUILDS, 
+        default 3), and never removes builds in use by this or any other process.
+        Returns the list of removed directories.
+    '''
+    if keep is None:
+        keep = getKeepBuildsCount()
+    
+    if os.path.isdir(path):
+        parentFolder = path
+        baseNames = []
+        cacheFolder = os.path.join(parentFolder, ".slangtorch_cache")
+        if os.path.isdir(cacheFolder):
+            # Skip shared folders such as the precompiled preludes.
+            baseNames = [name for name in os.listdir(cacheFolder) if not name.startswith(".")]
+    else:
+        parentFolder = os.path.dirname(path)
+        baseNames = [os.path.splitext(os.path.basename(path))[0]]
+
+    removed = []
+    for baseNameWoExt in baseNames:
+        baseOutputFolder = os.path.join(parentFolder, ".slangtorch_cache", baseNameWoExt)
+        if not os.path.isdir(baseOutputFolder):
+            continue
+        for optionsHash in os.listdir(baseOutputFolder):
+            outputFolder = os.path.join(baseOutputFolder, optionsHash)
+            if not os.path.isdir(outputFolder):
+                continue
+
+            # Take the same lock as loadModule. Lock files are named after the source file.
+            sourceNames = [f for f in os.listdir(parentFolder) 
+                           if os.path.splitext(f)[0] == baseNameWoExt and f.endswith(".slang")]
+            sourceName = sourceNames[0] if sourceNames else baseNameWoExt + ".slang"
+            lockFile = os.path.join(parentFolder, sourceName + optionsHash + ".lock")
+            with FileLock(lockFile):
+                removed.extend(_collectStaleBuildDirs(outputFolder, keep, verbose=verbose))
+
+    return removed
+
+
+PREBUILT_MANIFEST_FILE = "manifest.json"
+
+# Prebuilt modules imported by this process, by binary path.
+PREBUILT_MODULES = {}
+
+
+def _getPrebuiltPlatformInfo():
+    import sysconfig
+    import torch
+    return {
+        "torchVersion": torch.__version__,
+        "extSuffix": sysconfig.get_config_var('EXT_SUFFIX'),
+        "platform": sys.platform,
+    }
+
+
+def _normalizeDefines(defines):
+    return {str(key): str(value) for (key, value) in dict(defines or {}).items()}
+
+
+def buildPrebuiltModules(fileNames, outputDir, defines={}, includePaths=[], verbose=False, slangGenLineInfo=True, cudaFastMath=True, cudaGenLineInfo=True, extraSlangFlags=[], extraCudaFlags=[]):
+    r'''Builds Slang modules and copies their binaries into outputDir, along with a manifest 
+        that loadPrebuiltModule uses to find them. The directory can be moved to (and loaded on)
+        a machine with the same platform, python and torch versions, without any toolchain.
+        Returns the manifest.
+    '''
+    os.makedirs(outputDir, exist_ok=True)
+    manifestFile = os.path.join(outputDir, PREBUILT_MANIFEST_FILE)
+
+    platformInfo = _getPrebuiltPlatformInfo()
+    manifest = {"version": versionCode, **platformInfo, "modules": []}
+    if os.path.exists(manifestFile):
+        with open(manifestFile, 'r') as f:
+            existingManifest = json.load(f)
+        # Keep the modules of earlier builds for the same platform.
+        if all(existingManifest.get(key) == value for (key, value) in platformInfo.items()):
+            manifest["modules"] = existingManifest.get("modules", [])
+
+    # Prebuilt modules must not depend on anything in the build tree, such as the shared prelude library.
+    for fileName in fileNames:
+        fileName = os.path.abspath(fileName)
+        _, buildDir = _loadRawModule(
+            fileName, verbose=verbose, defines=dict(defines), includePaths=list(includePaths), 
+            slangGenLineInfo=slangGenLineInfo, cudaFastMath=cudaFastMath, cudaGenLineInfo=cudaGenLineInfo, 
+            extraSlangFlags=list(extraSlangFlags), extraCudaFlags=list(extraCudaFlags), sharedPrelude=False)
+
+        with open(os.path.join(buildDir, "metadata.json"), 'r') as f:
+            metadata = json.load(f)
+
+        moduleBinary = os.path.realpath(metadata["moduleBinary"])
+        binaryName = os.path.basename(moduleBinary)
+        shutil.copy2(moduleBinary, os.path.join(outputDir, binaryName))
+
+        entry = {
+            "name": os.path.splitext(os.path.basename(fileName))[0],
+            "source": os.path.basename(fileName),
+            "defines": _normalizeDefines(defines),
+            "moduleName": metadata["moduleName"],
+            "binary": binaryName,
+        }
+        manifest["modules"] = [m for m in manifest["modules"] 
+                               if not (m["name"] == entry["name"] and m["defines"] == entry["defines"])]
+        manifest["modules"].append(entry)
+
+        if verbose:
+            print(f"Prebuilt {fileName} -> {os.path.join(outputDir, binaryName)}", file=sys.stderr)
+
+    tmpFile = f"{manifestFile}.{os.getpid()}.tmp"
+    with open(tmpFile, 'w') as f:
+        json.dump(manifest, f, indent=4)
+    os.replace(tmpFile, manifestFile)
+
+    return manifest
+
+
+def loadPrebuiltModule(prebuiltDir, name, defines=None, verbose=False):
+    r'''Loads a module built with buildPrebuiltModules (or 'python -m slangtorch build').
+        'name' is the Slang file name (with or without extension). If defines is None and the 
+        package has a single build of the module, that build is used.
+        Does not require slangc or a compiler.
+    '''
+    with open(os.path.join(prebuiltDir, PREBUILT_MANIFEST_FILE), 'r') as f:
+        manifest = json.load(f)
+
+    platformInfo = _getPrebuiltPlatformInfo()
+    for (key, value) in platformInfo.items():
+        if manifest.get(key) != value:
+            raise RuntimeError(f"Prebuilt modules in {prebuiltDir} were built for {key} {manifest.get(key)}, "
+                               f"but this process uses {value}")
+
+    name = os.path.splitext(os.path.basename(name))[0]
+    candidates = [m for m in manifest["modules"] if m["name"] == name]
+    if defines is not None:
+        candidates = [m for m in candidates if m["defines"] == _normalizeDefines(defines)]
+
+    if len(candidates) == 0:
+        raise RuntimeError(f"No prebuilt module '{name}' with defines {defines} in {prebuiltDir}")
+    if len(candidates) > 1:
+        raise RuntimeError(f"Multiple prebuilt builds of '{name}' in {prebuiltDir}, specify defines to pick one: "
+                           f"{[m['defines'] for m in candidates]}")
+
+    entry = candidates[0]
+    moduleBinary = os.path.realpath(os.path.join(prebuiltDir, entry["binary"]))
+    if moduleBinary not in PREBUILT_MODULES:
+        if verbose:
+            print(f"Loading prebuilt module {moduleBinary}", file=sys.stderr)
+        PREBUILT_MODULES[moduleBinary] = wrapModule(_importModuleBinary(entry["moduleName"], moduleBinary))
+
+    return PREBUILT_MODULES[moduleBinary]
 
 
 def clearSessionShaderCache():
@@ -844,9 +2822,14 @@ def clearSessionShaderCache():
 def clearPersistentShaderCache():
     baseOutputFolder = os.path.join(packageDir, '.slangtorch_cache')
     if os.path.exists(baseOutputFolder):
-        import shutil
         shutil.rmtree(baseOutputFolder)
 
+    # The object store and the toolchain cache are in the user cache directory.
+    objectCacheDir = getObjectCacheDirPath()
+    if os.path.exists(objectCacheDir):
+        shutil.rmtree(objectCacheDir)
+    clearToolchainCache()
+
 
 def clearShaderCaches():
     clearSessionShaderCache()
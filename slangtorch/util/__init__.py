@@ -1,2 +1,11 @@
-from .compile import jit_compile, run_ninja, NinjaResult
-from .wrapper import wrapModule
\ No newline at end of file
+from .compile import jit_compile, run_ninja, collect_ninja_deps, get_host_compile_flags, NinjaResult
+from .wrapper import wrapModule
+from .slanglib import SlangLibraryCompiler
+from .global_cache import GlobalBuildCache
+from .clone import cloneBuildDir, copyFile
+from .pch import getPrecompiledPreludeSources, isPrecompiledPreludeFile
+from .jobs import getJobBudget
+from .objcache import trimObjectCache, splitModuleDefinition, isModuleDefinitionFile
+from .watch import FileWatcher
+from .buildlock import BuildLock
+from .variants import mergeVariantSources, VARIANT_SUBMODULE
@@ -0,0 +1,88 @@
+#
+# Exclusive build lock with efficient waiting. Uses flock() where available, so it excludes
+# (and is excluded by) filelock.FileLock on the same file, but processes that find it taken can
+# block in the kernel until the holder releases it instead of polling. The lock file is never
+# removed, so waiters always wait on the file the holder locked.
+#
+# Elsewhere, falls back to filelock.FileLock (which polls).
+#
+
+import os
+from filelock import FileLock, Timeout
+
+try:
+    import fcntl
+except ImportError:
+    fcntl = None
+
+
+class BuildLock(object):
+    def __init__(self, path) -> None:
+        self.path = path
+        self._fd = None
+        self._fileLock = FileLock(path) if fcntl is None else None
+
+    @property
+    def isHeld(self):
+        if self._fileLock is not None:
+            return self._fileLock.is_locked
+        return self._fd is not None
+
+    def _lock(self, operation):
+        fd = os.open(self.path, os.O_RDWR | os.O_CREAT, 0o666)
+        try:
+            fcntl.flock(fd, operation)
+        except OSError:
+            os.close(fd)
+            raise
+        return fd
+
+    def tryAcquire(self):
+        r'''Takes the lock if it is free. Returns False if another process (or thread) holds it.'''
+        if self._fileLock is not None:
+            try:
+                self._fileLock.acquire(timeout=0)
+                return True
+            except Timeout:
+                return False
+
+        try:
+            self._fd = self._lock(fcntl.LOCK_EX | fcntl.LOCK_NB)
+        except BlockingIOError:
+            return False
+        return True
+
+    def acquire(self):
+        if self._fileLock is not None:
+            self._fileLock.acquire()
+        else:
+            self._fd = self._lock(fcntl.LOCK_EX)
+
+    def waitForRelease(self):
+        r'''Blocks until the current holder releases the lock, without taking it.'''
+        if self._fileLock is not None:
+            with self._fileLock:
+                return
+
+        # A shared lock is granted as soon as the exclusive holder is gone, and doesn't
+        # block the other waiters.
+        #
+        fd = self._lock(fcntl.LOCK_SH)
+        fcntl.flock(fd, fcntl.LOCK_UN)
+        os.close(fd)
+
+    def release(self):
+        if self._fileLock is not None:
+            self._fileLock.release()
+        elif self._fd is not None:
+            fcntl.flock(self._fd, fcntl.LOCK_UN)
+            os.close(self._fd)
+            self._fd = None
+
+    def __enter__(self):
+        if not self.isHeld:
+            self.acquire()
+        return self
+
+    def __exit__(self, *args):
+        self.release()
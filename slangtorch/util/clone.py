@@ -0,0 +1,103 @@
+#
+# Cloning of build directories. A new build directory starts out as a clone of the latest
+# one so that ninja can build incrementally, but most of its contents (object files, the
+# previous module binary) are never modified in the clone, only replaced.
+#
+
+import os
+import sys
+import errno
+import shutil
+
+try:
+    import fcntl
+except ImportError:
+    fcntl = None
+
+# From linux/fs.h
+FICLONE = 0x40049409
+
+# Build outputs that are only ever replaced, never written in place. The GNU and LLVM
+# assemblers and linkers remove an existing output before writing a new one, so a hardlinked
+# copy in another build directory is never modified. MSVC's incremental linker does write in
+# place, so these are not hardlinked on Windows.
+#
+IMMUTABLE_EXTENSIONS = (".o", ".obj", ".so", ".pyd", ".dylib", ".lib", ".exp", ".gch")
+
+# Process and build locks of the source directory. These must not be carried over.
+SKIPPED_FILES = ("lock", ".inuse.lock")
+
+
+def _tryReflink(srcFile, dstFile):
+    if fcntl is None or not sys.platform.startswith("linux"):
+        return False
+
+    with open(srcFile, 'rb') as src:
+        dstFd = os.open(dstFile, os.O_WRONLY | os.O_CREAT | os.O_TRUNC, 0o666)
+        try:
+            fcntl.ioctl(dstFd, FICLONE, src.fileno())
+        except OSError:
+            os.close(dstFd)
+            os.remove(dstFile)
+            return False
+        os.close(dstFd)
+
+    shutil.copystat(srcFile, dstFile)
+    return True
+
+
+def copyFile(srcFile, dstFile):
+    r'''Copies srcFile to dstFile, as a reflink where the filesystem supports it. Never
+        hardlinks: the copy is a separate file that the dynamic loader treats as a new library.
+    '''
+    if not _tryReflink(srcFile, dstFile):
+        shutil.copy2(srcFile, dstFile)
+
+
+def cloneBuildDir(srcDir, dstDir, verbose=False):
+    r'''Clones srcDir into dstDir. Files are reflinked where the filesystem supports it,
+        immutable build outputs are hardlinked otherwise, and everything else is copied.
+        Timestamps are preserved so that ninja sees the clone as up to date.
+    '''
+    canReflink = fcntl is not None and sys.platform.startswith("linux")
+    canHardlink = sys.platform != "win32"
+    stats = {"reflinked": 0, "hardlinked": 0, "copied": 0}
+
+    for dirPath, dirNames, fileNames in os.walk(srcDir):
+        targetPath = os.path.join(dstDir, os.path.relpath(dirPath, srcDir))
+        os.makedirs(targetPath, exist_ok=True)
+
+        for fileName in fileNames:
+            if fileName in SKIPPED_FILES:
+                continue
+
+            srcFile = os.path.join(dirPath, fileName)
+            dstFile = os.path.join(targetPath, fileName)
+            if os.path.islink(srcFile):
+                os.symlink(os.readlink(srcFile), dstFile)
+                continue
+
+            # Stop trying after the first failure, the filesystem doesn't support it.
+            if canReflink:
+                if _tryReflink(srcFile, dstFile):
+                    stats["reflinked"] += 1
+                    continue
+                canReflink = False
+
+            if canHardlink and fileName.endswith(IMMUTABLE_EXTENSIONS):
+                try:
+                    os.link(srcFile, dstFile)
+                    stats["hardlinked"] += 1
+                    continue
+                except OSError as e:
+                    if e.errno not in (errno.EXDEV, errno.EPERM, errno.EMLINK, errno.ENOTSUP):
+                        raise
+
+            shutil.copy2(srcFile, dstFile)
+            stats["copied"] += 1
+
+    if verbose:
+        print(f"Cloned {srcDir} -> {dstDir} ({stats['reflinked']} reflinked, "
+              f"{stats['hardlinked']} hardlinked, {stats['copied']} copied)", file=sys.stderr)
+
+    return stats
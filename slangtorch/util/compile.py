@@ -4,12 +4,16 @@
 #
 
 from torch.utils.cpp_extension import (
-    _write_ninja_file_and_build_library,
+    _write_ninja_file_to_build_library,
+    _prepare_ldflags,
     _import_module_from_library,
     _get_exec_path,
     _join_rocm_home,
     _is_cuda_file,
     _get_num_workers,
+    verify_ninja_availability,
+    get_cxx_compiler,
+    get_compiler_abi_compatibility_and_version,
     PLAT_TO_VCVARS,
     _TORCH_PATH,
     JIT_EXTENSION_VERSIONER,
@@ -17,16 +21,19 @@ from torch.utils.cpp_extension import (
     IS_WINDOWS
 )
 
-from torch.utils.file_baton import FileBaton
 from torch.utils.hipify import hipify_python
 from torch.torch_version import TorchVersion
 from torch import __version__ as TORCH_VERSION
 
-from typing import Optional
+from typing import List, Optional
 import sys
 import os
 import subprocess
 
+from .jobs import getJobBudget
+from .buildlock import BuildLock
+from .objcache import enableObjectCache, isolateModuleName, MODULE_SOURCE_SUFFIX
+
 def jit_compile(name,
                  sources,
                  extra_cflags,
@@ -40,7 +47,9 @@ def jit_compile(name,
                  with_sycl: Optional[bool],
                  is_python_module,
                  is_standalone,
-                 keep_intermediates=True) -> None:
+                 keep_intermediates=True,
+                 object_cache_dir: Optional[str] = None,
+                 object_cache_base_dirs: Optional[List[str]] = None) -> None:
     if is_python_module and is_standalone:
         raise ValueError("`is_python_module` and `is_standalone` are mutually exclusive.")
 
@@ -48,8 +57,9 @@ def jit_compile(name,
         with_cuda = any(map(_is_cuda_file, sources))
     with_cudnn = any(['cudnn' in f for f in extra_ldflags or []])
 
-    baton = FileBaton(os.path.join(build_directory, 'lock'))
-    if baton.try_acquire():
+    # Other builders of the same directory wait for this one to finish, then load its result.
+    buildLock = BuildLock(os.path.join(build_directory, 'lock'))
+    if buildLock.tryAcquire():
         try:
             with hipify_python.GeneratedFileCleaner(keep_intermediates=keep_intermediates) as clean_ctx:
                 if IS_HIP_EXTENSION and (with_cuda or with_cudnn):
@@ -72,38 +82,27 @@ def jit_compile(name,
 
                     sources = list(hipified_sources)
                 
-                if TorchVersion(TORCH_VERSION) >= TorchVersion('2.7.0'):
-                    _write_ninja_file_and_build_library(
-                        name=name,
-                        sources=sources,
-                        extra_cflags=extra_cflags or [],
-                        extra_cuda_cflags=extra_cuda_cflags or [],
-                        extra_sycl_cflags=extra_sycl_cflags or [],
-                        extra_ldflags=extra_ldflags or [],
-                        extra_include_paths=extra_include_paths or [],
-                        build_directory=build_directory,
-                        verbose=verbose,
-                        with_cuda=with_cuda,
-                        with_sycl=with_sycl,
-                        is_standalone=is_standalone)
-                else:
-                    if (with_sycl is True) or (extra_sycl_cflags):
-                        print("Warning: SYCL support is not available in this version of PyTorch. SYCL flags will be ignored.")
-                    _write_ninja_file_and_build_library(
-                        name=name,
-                        sources=sources,
-                        extra_cflags=extra_cflags or [],
-                        extra_cuda_cflags=extra_cuda_cflags or [],
-                        extra_ldflags=extra_ldflags or [],
-                        extra_include_paths=extra_include_paths or [],
-                        build_directory=build_directory,
-                        verbose=verbose,
-                        with_cuda=with_cuda,
-                        is_standalone=is_standalone)
+                if TorchVersion(TORCH_VERSION) < TorchVersion('2.7.0') and ((with_sycl is True) or (extra_sycl_cflags)):
+                    print("Warning: SYCL support is not available in this version of PyTorch. SYCL flags will be ignored.")
+                _write_ninja_file_and_build_library(
+                    name=name,
+                    sources=sources,
+                    extra_cflags=extra_cflags or [],
+                    extra_cuda_cflags=extra_cuda_cflags or [],
+                    extra_sycl_cflags=extra_sycl_cflags or [],
+                    extra_ldflags=extra_ldflags or [],
+                    extra_include_paths=extra_include_paths or [],
+                    build_directory=build_directory,
+                    verbose=verbose,
+                    with_cuda=with_cuda,
+                    with_sycl=with_sycl,
+                    is_standalone=is_standalone,
+                    object_cache_dir=object_cache_dir,
+                    object_cache_base_dirs=object_cache_base_dirs)
         finally:
-            baton.release()
+            buildLock.release()
     else:
-        baton.wait()
+        buildLock.waitForRelease()
 
     if verbose:
         print(f'Loading extension module {name}...', file=sys.stderr)
@@ -114,6 +113,119 @@ def jit_compile(name,
     return _import_module_from_library(name, build_directory, is_python_module)
 
 
+def _write_ninja_file_and_build_library(name,
+                                        sources,
+                                        extra_cflags,
+                                        extra_cuda_cflags,
+                                        extra_sycl_cflags,
+                                        extra_ldflags,
+                                        extra_include_paths,
+                                        build_directory: str,
+                                        verbose: bool,
+                                        with_cuda: Optional[bool],
+                                        with_sycl: Optional[bool],
+                                        is_standalone: bool = False,
+                                        object_cache_dir: Optional[str] = None,
+                                        object_cache_base_dirs: Optional[List[str]] = None) -> None:
+    r'''Modified version of torch.utils.cpp_extension._write_ninja_file_and_build_library that
+        runs ninja through run_ninja, so that the build takes its jobs from the process-wide 
+        job budget instead of starting as many as there are CPUs. If object_cache_dir is set, 
+        sources are compiled through the object cache in that directory, with paths under
+        object_cache_base_dirs left out of the cache keys. If the module definition was split
+        from the host source, only its own source gets the module name define.
+    '''
+    verify_ninja_availability()
+    get_compiler_abi_compatibility_and_version(get_cxx_compiler())
+    if with_cuda is None:
+        with_cuda = any(map(_is_cuda_file, sources))
+    extra_ldflags = _prepare_ldflags(extra_ldflags, with_cuda, verbose, is_standalone)
+    build_file_path = os.path.join(build_directory, 'build.ninja')
+    if verbose:
+        print(f'Emitting ninja build file {build_file_path}...', file=sys.stderr)
+
+    kwargs = dict(
+        path=build_file_path,
+        name=name,
+        sources=sources,
+        extra_cflags=extra_cflags,
+        extra_cuda_cflags=extra_cuda_cflags,
+        extra_ldflags=extra_ldflags,
+        extra_include_paths=extra_include_paths,
+        with_cuda=with_cuda,
+        is_standalone=is_standalone)
+    if TorchVersion(TORCH_VERSION) >= TorchVersion('2.7.0'):
+        kwargs.update(extra_sycl_cflags=extra_sycl_cflags, with_sycl=with_sycl)
+    _write_ninja_file_to_build_library(**kwargs)
+    if any(source.endswith(MODULE_SOURCE_SUFFIX) for source in sources):
+        isolateModuleName(build_file_path)
+    if object_cache_dir is not None:
+        enableObjectCache(build_file_path, object_cache_dir, object_cache_base_dirs or [])
+
+    if verbose:
+        print(f'Building extension module {name}...', file=sys.stderr)
+
+    # One compile job per source, the link runs after them.
+    run_ninja(build_directory, verbose, jobs=len(sources), error_prefix=f"Error building extension '{name}'")
+
+
+def get_host_compile_flags(build_directory: str,
+                           extra_cflags,
+                           extra_include_paths,
+                           with_cuda: bool = True):
+    r'''Returns the host compiler and flags torch uses for C++ sources of an extension, as
+        a dict with 'cxx', 'cflags', 'post_cflags' and 'ldflags' (strings, ninja-escaped).
+
+        Writes a throwaway ninja file with torch's generator and reads the variables
+        back, so the flags match jit_compile's exactly. The extension name define is
+        left out.
+    '''
+    flags_file = os.path.join(build_directory, 'flags.ninja')
+    kwargs = dict(
+        path=flags_file,
+        name='_slangtorch_flags',
+        sources=[os.path.join(build_directory, 'flags.cpp')],
+        extra_cflags=extra_cflags or [],
+        extra_cuda_cflags=[],
+        extra_ldflags=[],
+        extra_include_paths=extra_include_paths or [],
+        with_cuda=with_cuda,
+        is_standalone=False)
+    if TorchVersion(TORCH_VERSION) >= TorchVersion('2.7.0'):
+        kwargs.update(extra_sycl_cflags=[], with_sycl=False)
+    _write_ninja_file_to_build_library(**kwargs)
+
+    variables = {'cxx': None, 'cflags': '', 'post_cflags': '', 'ldflags': ''}
+    with open(flags_file, 'r') as f:
+        for line in f:
+            name, sep, value = line.partition(' = ')
+            if sep and name in variables:
+                variables[name] = value.strip()
+
+    variables['cflags'] = ' '.join(
+        flag for flag in variables['cflags'].split(' ')
+        if not flag.startswith(('-DTORCH_EXTENSION_NAME=', '/DTORCH_EXTENSION_NAME=')))
+    return variables
+
+
+_vc_env = None
+
+def _get_vc_env():
+    r'''Returns the MSVC build environment. Deriving it runs vcvarsall, so it is computed
+        once per process.
+    '''
+    global _vc_env
+    if _vc_env is None:
+        import sysconfig
+        from setuptools.msvc import EnvironmentInfo
+
+        plat_name = sysconfig.get_platform()
+        plat_spec = PLAT_TO_VCVARS[plat_name]
+
+        vc_env = EnvironmentInfo(plat_spec).return_env()
+        _vc_env = {k.upper(): v for k, v in vc_env.items()}
+    return _vc_env
+
+
 class NinjaResult:
     BUILD_FAIL = 0
     BUILD_SUCCESS = 1
@@ -121,25 +233,29 @@ class NinjaResult:
 
 def run_ninja(
         build_directory: str,
-        verbose: bool) -> int:
+        verbose: bool,
+        jobs: Optional[int] = None,
+        error_prefix: Optional[str] = None) -> int:
     r'''Modified version of torch.utils.cpp_extension._run_ninja that explicitly 
         detects a couple of cases: when there's no work to do & when ninja fails.
+
+        Runs with up to 'jobs' parallel jobs (all of the job budget if None), as granted by 
+        the process-wide job budget. If error_prefix is set, a failed build raises a 
+        RuntimeError with the build output, like torch's _run_ninja_build.
     '''
-    command = ['ninja', '-v']
-    num_workers = _get_num_workers(verbose)
-    if num_workers is not None:
-        command.extend(['-j', str(num_workers)])
+    budget = getJobBudget(verbose)
+    if jobs is None:
+        jobs = _get_num_workers(verbose) or budget.maxJobs
+    with budget.reserve(jobs) as num_workers:
+        return _run_ninja(build_directory, verbose, num_workers, error_prefix)
+
+
+def _run_ninja(build_directory: str, verbose: bool, num_workers: int, error_prefix: Optional[str]) -> int:
+    command = ['ninja', '-v', '-j', str(num_workers)]
     env = os.environ.copy()
     # Try to activate the vc env for the users
     if IS_WINDOWS and 'VSCMD_ARG_TGT_ARCH' not in env:
-        import sysconfig
-        from setuptools.msvc import EnvironmentInfo
-
-        plat_name = sysconfig.get_platform()
-        plat_spec = PLAT_TO_VCVARS[plat_name]
-
-        vc_env = EnvironmentInfo(plat_spec).return_env()
-        vc_env = {k.upper(): v for k, v in vc_env.items()}
+        vc_env = dict(_get_vc_env())
         for k, v in env.items():
             uk = k.upper()
             if uk not in vc_env:
@@ -172,7 +288,46 @@ def run_ninja(
         #
         return NinjaResult.BUILD_SUCCESS
     except subprocess.CalledProcessError as e:
+        if error_prefix is not None:
+            raise RuntimeError(f"{error_prefix}: {e.stdout.decode()}{e.stderr.decode()}") from e
         if verbose:
             print(e.stdout.decode())
             print(e.stderr.decode())
         return NinjaResult.BUILD_FAIL
+
+
+def collect_ninja_deps(build_directory: str):
+    r'''Returns the list of implicit dependencies (headers, preludes, etc.) that ninja
+        recorded for the last build in build_directory, as real paths.
+
+        Uses 'ninja -t deps', which reads the .ninja_deps log without checking whether
+        any target is dirty. Returns None if the log could not be read.
+    '''
+    try:
+        proc = subprocess.run(
+            ['ninja', '-t', 'deps'],
+            stdout=subprocess.PIPE,
+            stderr=subprocess.PIPE,
+            cwd=build_directory,
+            check=True)
+    except (subprocess.CalledProcessError, OSError):
+        return None
+
+    deps = []
+    seen = set()
+    for line in proc.stdout.decode().splitlines():
+        # Target lines look like "foo.o: #deps 12, deps mtime 123 (VALID)", and are followed
+        # by one indented line per dependency.
+        if not line.startswith((' ', '\t')):
+            continue
+        path = line.strip()
+        if not path:
+            continue
+        if not os.path.isabs(path):
+            path = os.path.join(build_directory, path)
+        path = os.path.realpath(path)
+        if path not in seen:
+            seen.add(path)
+            deps.append(path)
+
+    return deps
@@ -0,0 +1,202 @@
+#
+# Content-addressed cache of built extension modules, shared across source directories.
+#
+# Layout:
+#   <root>/entries/<key[:2]>/<key>/entry.json     Module name, header dependencies. Its mtime
+#                                                 is the last time the entry was used (LRU).
+#   <root>/entries/<key[:2]>/<key>/<moduleName>.so
+#
+
+import os
+import sys
+import json
+import shutil
+import hashlib
+import uuid
+import time
+from filelock import FileLock
+
+
+def _fileDigest(fileName):
+    hashObject = hashlib.sha256()
+    with open(fileName, 'rb') as f:
+        for chunk in iter(lambda: f.read(1 << 20), b''):
+            hashObject.update(chunk)
+    return hashObject.hexdigest()
+
+
+def _isSubPath(path, directory):
+    try:
+        return os.path.commonpath([os.path.realpath(path), os.path.realpath(directory)]) == os.path.realpath(directory)
+    except ValueError:
+        return False
+
+
+class GlobalBuildCache(object):
+    def __init__(self, root, maxSizeBytes) -> None:
+        self.root = os.path.realpath(root)
+        self.maxSizeBytes = maxSizeBytes
+        self.entriesDir = os.path.join(self.root, "entries")
+        self.tmpDir = os.path.join(self.root, "tmp")
+
+        # Entries whose binaries are loaded in this process. These are never evicted by this process.
+        self.inUse = set()
+
+        os.makedirs(self.entriesDir, exist_ok=True)
+        os.makedirs(self.tmpDir, exist_ok=True)
+
+    @staticmethod
+    def makeKey(sourceFiles, compileFlags, toolchainFingerprint, sourceDir=None):
+        hashObject = hashlib.sha256()
+        for sourceFile in sourceFiles:
+            with open(sourceFile, 'rb') as f:
+                contents = f.read()
+
+            # Generated sources reference the Slang source directory in #line directives. Leave it out
+            # of the key so that identical modules in different directories share an entry.
+            #
+            if sourceDir:
+                for path in set([sourceDir, sourceDir.replace('\\', '\\\\'), sourceDir.replace('\\', '/')]):
+                    contents = contents.replace(path.encode('utf-8'), b'<source>')
+
+            hashObject.update(hashlib.sha256(contents).hexdigest().encode())
+        hashObject.update(json.dumps([compileFlags, toolchainFingerprint], sort_keys=True).encode())
+        return hashObject.hexdigest()
+
+    def _entryDir(self, key):
+        return os.path.join(self.entriesDir, key[:2], key)
+
+    def _lock(self):
+        return FileLock(os.path.join(self.root, "cache.lock"))
+
+    def lookup(self, key, sourceDir, verbose=False):
+        r'''Returns (moduleName, moduleBinary, headerDeps) for a valid entry, or None.
+            Header dependencies under sourceDir are stored relative to it, and are
+            validated against the files in the current sourceDir.
+        '''
+        entryDir = self._entryDir(key)
+        entryFile = os.path.join(entryDir, "entry.json")
+        try:
+            with open(entryFile, 'r') as f:
+                entry = json.load(f)
+        except (OSError, ValueError):
+            return None
+
+        moduleBinary = os.path.join(entryDir, entry["moduleBinary"])
+        if not os.path.exists(moduleBinary):
+            return None
+
+        headerDeps = []
+        for (location, path, timestamp, digest) in entry["headerDeps"]:
+            depFile = os.path.join(sourceDir, path) if location == "source" else path
+            if not os.path.exists(depFile):
+                if verbose:
+                    print(f"Global cache entry {key[:16]}: header {depFile} does not exist.", file=sys.stderr)
+                return None
+
+            # Files outside the source directory (torch, CUDA headers) usually keep their mtimes,
+            # so only hash them when the mtime differs.
+            #
+            if not (location == "absolute" and os.path.getmtime(depFile) == timestamp):
+                if _fileDigest(depFile) != digest:
+                    if verbose:
+                        print(f"Global cache entry {key[:16]}: header {depFile} is different.", file=sys.stderr)
+                    return None
+
+            headerDeps.append(depFile)
+
+        # Mark the entry as recently used.
+        try:
+            os.utime(entryFile, None)
+        except OSError:
+            pass
+
+        self.inUse.add(key)
+        return entry["moduleName"], moduleBinary, headerDeps
+
+    def insert(self, key, moduleName, moduleBinary, headerDeps, sourceDir, verbose=False):
+        entryDir = self._entryDir(key)
+        if os.path.exists(os.path.join(entryDir, "entry.json")):
+            return
+
+        storedHeaderDeps = []
+        for depFile in headerDeps:
+            if not os.path.exists(depFile):
+                continue
+            if sourceDir and _isSubPath(depFile, sourceDir):
+                storedHeaderDeps.append(("source", os.path.relpath(depFile, sourceDir), os.path.getmtime(depFile), _fileDigest(depFile)))
+            else:
+                storedHeaderDeps.append(("absolute", depFile, os.path.getmtime(depFile), _fileDigest(depFile)))
+
+        # Populate a private directory, then publish it with a single rename.
+        stagingDir = os.path.join(self.tmpDir, uuid.uuid4().hex)
+        os.makedirs(stagingDir)
+        try:
+            binaryName = os.path.basename(moduleBinary)
+            shutil.copy2(moduleBinary, os.path.join(stagingDir, binaryName))
+            with open(os.path.join(stagingDir, "entry.json"), 'w') as f:
+                json.dump({"moduleName": moduleName, "moduleBinary": binaryName, "headerDeps": storedHeaderDeps}, f, indent=4)
+
+            os.makedirs(os.path.dirname(entryDir), exist_ok=True)
+            with self._lock():
+                if not os.path.exists(entryDir):
+                    os.rename(stagingDir, entryDir)
+                    if verbose:
+                        print(f"Added {moduleName} to the global cache ({key[:16]})", file=sys.stderr)
+        finally:
+            if os.path.exists(stagingDir):
+                shutil.rmtree(stagingDir, ignore_errors=True)
+
+        self.evict(verbose)
+
+    def evict(self, verbose=False):
+        r'''Removes the least recently used entries until the cache fits in maxSizeBytes.
+        '''
+        if self.maxSizeBytes is None:
+            return
+
+        with self._lock():
+            entries = []
+            totalSize = 0
+            for prefix in os.listdir(self.entriesDir):
+                prefixDir = os.path.join(self.entriesDir, prefix)
+                if not os.path.isdir(prefixDir):
+                    continue
+                for key in os.listdir(prefixDir):
+                    entryDir = os.path.join(prefixDir, key)
+                    try:
+                        lastUsed = os.path.getmtime(os.path.join(entryDir, "entry.json"))
+                    except OSError:
+                        lastUsed = 0
+                    size = 0
+                    for dirPath, _, fileNames in os.walk(entryDir):
+                        for fileName in fileNames:
+                            try:
+                                size += os.path.getsize(os.path.join(dirPath, fileName))
+                            except OSError:
+                                pass
+                    entries.append((lastUsed, key, entryDir, size))
+                    totalSize += size
+
+            entries.sort()
+            for (lastUsed, key, entryDir, size) in entries:
+                if totalSize <= self.maxSizeBytes:
+                    break
+                if key in self.inUse:
+                    continue
+
+                # Move the entry out of the way first so that readers never see a partial entry.
+                # This fails on platforms that don't allow removing loaded binaries, in which case
+                # the entry is kept.
+                #
+                trashDir = os.path.join(self.tmpDir, f"evicted-{uuid.uuid4().hex}")
+                try:
+                    os.rename(entryDir, trashDir)
+                except OSError:
+                    continue
+                shutil.rmtree(trashDir, ignore_errors=True)
+                totalSize -= size
+
+                if verbose:
+                    print(f"Evicted global cache entry {key[:16]} "
+                          f"(last used {time.ctime(lastUsed)})", file=sys.stderr)
@@ -0,0 +1,95 @@
+#
+# Process-wide budget for compiler processes (slangc, nvcc and the host compiler).
+#
+# Every ninja run and slangc invocation reserves job slots here before starting, and runs
+# with as many parallel jobs as it was granted. This bounds the total number of compiler
+# processes, and their estimated memory, across all modules being built concurrently.
+#
+# Settings (read when the budget is first used):
+#   MAX_JOBS                      Maximum number of concurrent jobs (same variable as torch).
+#                                 Defaults to the number of CPUs.
+#   SLANGTORCH_JOB_MEMORY_MB      Estimated peak memory of one job. Defaults to 2048.
+#   SLANGTORCH_BUILD_MEMORY_MB    Memory available to all jobs. Defaults to 3/4 of the
+#                                 available memory (MemAvailable on Linux, which counts
+#                                 reclaimable page cache). Not limited elsewhere.
+#
+
+import os
+import sys
+import threading
+from contextlib import contextmanager
+
+DEFAULT_JOB_MEMORY_MB = 2048
+
+
+def _getAvailableMemoryMB(meminfoFile='/proc/meminfo'):
+    # Free memory alone (SC_AVPHYS_PAGES, MemFree) leaves out the page cache, which is most of
+    # the memory of a machine that has been up for a while.
+    #
+    try:
+        with open(meminfoFile, 'r') as f:
+            for line in f:
+                name, _, value = line.partition(':')
+                if name == 'MemAvailable':
+                    return int(value.split()[0]) // 1024
+    except (OSError, ValueError, IndexError):
+        pass
+    return None
+
+
+class JobBudget(object):
+    def __init__(self, maxJobs, maxMemoryMB=None, jobMemoryMB=DEFAULT_JOB_MEMORY_MB) -> None:
+        maxJobs = max(1, maxJobs)
+        if maxMemoryMB is not None:
+            maxJobs = max(1, min(maxJobs, maxMemoryMB // max(1, jobMemoryMB)))
+
+        self.maxJobs = maxJobs
+        self.freeJobs = maxJobs
+        self._condition = threading.Condition()
+
+    def acquire(self, wanted):
+        r'''Waits until at least one slot is free, and returns the number of slots granted
+            (between 1 and wanted).
+        '''
+        wanted = max(1, min(wanted, self.maxJobs))
+        with self._condition:
+            while self.freeJobs == 0:
+                self._condition.wait()
+            granted = min(wanted, self.freeJobs)
+            self.freeJobs -= granted
+            return granted
+
+    def release(self, count):
+        with self._condition:
+            self.freeJobs += count
+            self._condition.notify_all()
+
+    @contextmanager
+    def reserve(self, wanted):
+        granted = self.acquire(wanted)
+        try:
+            yield granted
+        finally:
+            self.release(granted)
+
+
+_jobBudget = None
+_jobBudgetLock = threading.Lock()
+
+
+def getJobBudget(verbose=False):
+    global _jobBudget
+    with _jobBudgetLock:
+        if _jobBudget is None:
+            maxJobs = int(os.environ.get('MAX_JOBS', '0') or 0) or os.cpu_count() or 1
+            jobMemoryMB = int(os.environ.get('SLANGTORCH_JOB_MEMORY_MB', DEFAULT_JOB_MEMORY_MB))
+            if 'SLANGTORCH_BUILD_MEMORY_MB' in os.environ:
+                maxMemoryMB = int(os.environ['SLANGTORCH_BUILD_MEMORY_MB'])
+            else:
+                availableMemoryMB = _getAvailableMemoryMB()
+                maxMemoryMB = availableMemoryMB * 3 // 4 if availableMemoryMB else None
+
+            _jobBudget = JobBudget(maxJobs, maxMemoryMB, jobMemoryMB)
+            if verbose:
+                print(f"Compiler job budget: {_jobBudget.maxJobs} job(s)", file=sys.stderr)
+        return _jobBudget
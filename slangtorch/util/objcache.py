@@ -0,0 +1,397 @@
+#
+# Object-level compile cache (ccache-like) for the host and CUDA sources of extension modules.
+#
+# Builds run the compiler through this script (see enableObjectCache, which rewrites the
+# 'cxx' and 'nvcc' variables of a build.ninja). A compile is keyed by:
+#   - the identity of the compiler (and of the host compiler, for nvcc),
+#   - the flags, minus the output paths and the preprocessor flags (-D, -I, ...), whose effect
+#     is part of the preprocessed source,
+#   - the preprocessed source, with the build directory and the base directories (the
+#     directory of the generated sources, and the Slang source directory) replaced by 
+#     placeholders.
+# The object file, depfile and compiler diagnostics are stored under that key, and identical
+# translation units in other build directories, modules or options hashes are served from
+# the store instead of being compiled again. Like with ccache's base_dir, paths under a base 
+# directory that end up in an object (line info, __FILE__) may name another directory.
+#
+# The name of an extension module is part of its host source (PYBIND11_MODULE expands it), and 
+# includes the build ID. splitModuleDefinition moves the module definition to a source of its 
+# own, so that the rest of the host source doesn't depend on the name. isolateModuleName passes
+# the name define to that source only.
+#
+# Layout:
+#   <root>/<key[:2]>/<key>.o         Object file. Its mtime is the last time it was used (LRU).
+#   <root>/<key[:2]>/<key>.d         Depfile, with the build and base directories and the 
+#                                    target replaced.
+#   <root>/<key[:2]>/<key>.stderr    Diagnostics of the compile.
+#
+# This file is run as a script by ninja, so it only uses the standard library.
+#
+
+import os
+import re
+import sys
+import shlex
+import shutil
+import hashlib
+import subprocess
+
+VERSION = 2
+
+BUILD_DIR_PLACEHOLDER = b"<build>"
+BASE_DIR_PLACEHOLDER = "<base{}>"
+TARGET_PLACEHOLDER = b"<target>"
+
+BASE_DIR_OPTION = "--base-dir"
+
+SOURCE_EXTENSIONS = (".c", ".cc", ".cpp", ".cxx", ".cu")
+
+# Flags followed by a separate value.
+#   Output options are dropped entirely, preprocessor options are left out of the key.
+#
+OUTPUT_OPTIONS = ("-o", "-MF", "--dependency-output", "-MT", "-MQ")
+OUTPUT_FLAGS = ("-c", "-MMD", "-MD", "--generate-dependencies-with-compile")
+PREPROCESSOR_OPTIONS = ("-D", "-U", "-I", "-isystem", "-iquote", "-idirafter", "-include")
+ARCH_OPTIONS = ("-gencode", "--generate-code", "-arch", "--gpu-architecture", "-code", "--gpu-code")
+
+# Options that also take their value attached ('-DX').
+ATTACHED_VALUE_OPTIONS = ("-D", "-U", "-I")
+
+MODULE_INIT_FUNCTION = "slangtorch_init_module"
+MODULE_SOURCE_SUFFIX = "_slangtorch_module.cpp"
+MODULE_NAME_FLAGS = ("-DTORCH_EXTENSION_NAME=", "/DTORCH_EXTENSION_NAME=")
+_PYBIND11_MODULE = re.compile(r'^(\s*)PYBIND11_MODULE\s*\(\s*TORCH_EXTENSION_NAME\s*,\s*(\w+)\s*\)', re.MULTILINE)
+
+
+def _fileIdentity(path):
+    if path is None:
+        return None
+    path = shutil.which(path) or path
+    try:
+        path = os.path.realpath(path)
+        stat = os.stat(path)
+        return [path, stat.st_size, stat.st_mtime]
+    except OSError:
+        return None
+
+
+def _matchOption(arg, option):
+    return (arg == option or arg.startswith(option + "=") or
+            (option in ATTACHED_VALUE_OPTIONS and arg.startswith(option)))
+
+
+def _splitOptions(args, options):
+    r'''Splits args into (the options in 'options' with their values, everything else). Handles
+        the '-D X' and '--option=X' forms, and '-DX' for ATTACHED_VALUE_OPTIONS. Other arguments
+        that merely start with an option ('-include-pch' for '-include') are not matched.
+    '''
+    matched = []
+    rest = []
+    i = 0
+    while i < len(args):
+        arg = args[i]
+        option = next((o for o in options if _matchOption(arg, o)), None)
+        if option is None:
+            rest.append(arg)
+        elif arg == option and i + 1 < len(args):
+            matched.extend(args[i:i + 2])
+            i += 1
+        else:
+            matched.append(arg)
+        i += 1
+    return matched, rest
+
+
+def _getOptionValue(args, option):
+    for i, arg in enumerate(args[:-1]):
+        if arg == option:
+            return args[i + 1]
+    return None
+
+
+def _isNvcc(compiler):
+    return os.path.basename(compiler).startswith("nvcc")
+
+
+def _compile(command):
+    # Run the real compile, passing its output through.
+    return subprocess.call(command)
+
+
+def _readFile(path):
+    with open(path, 'rb') as f:
+        return f.read()
+
+
+def _writeFileAtomic(path, contents):
+    tmpFile = f"{path}.{os.getpid()}.tmp"
+    with open(tmpFile, 'wb') as f:
+        f.write(contents)
+    os.replace(tmpFile, path)
+
+
+def _copyFileAtomic(srcFile, dstFile):
+    tmpFile = f"{dstFile}.{os.getpid()}.tmp"
+    shutil.copyfile(srcFile, tmpFile)
+    os.replace(tmpFile, dstFile)
+
+
+def _replacePaths(contents, buildDir, baseDirs):
+    # Directories are nested (the build directory is in the directory of the generated sources,
+    # which is in the Slang source directory), the innermost is replaced first.
+    #
+    contents = contents.replace(buildDir.encode('utf-8'), BUILD_DIR_PLACEHOLDER)
+    for index, baseDir in enumerate(baseDirs):
+        contents = contents.replace(baseDir.encode('utf-8'), BASE_DIR_PLACEHOLDER.format(index).encode('utf-8'))
+    return contents
+
+
+def _restorePaths(contents, buildDir, baseDirs):
+    for index, baseDir in reversed(list(enumerate(baseDirs))):
+        contents = contents.replace(BASE_DIR_PLACEHOLDER.format(index).encode('utf-8'), baseDir.encode('utf-8'))
+    return contents.replace(BUILD_DIR_PLACEHOLDER, buildDir.encode('utf-8'))
+
+
+def makeKey(compiler, args, buildDir, baseDirs=[]):
+    r'''Returns the cache key of a compile, or None if it can't be cached.'''
+    if "-c" not in args or "-E" in args:
+        return None
+
+    sources = [arg for arg in args if arg.endswith(SOURCE_EXTENSIONS) and os.path.isfile(arg)]
+    if len(sources) != 1 or _getOptionValue(args, "-o") is None:
+        return None
+
+    _, compileArgs = _splitOptions(args, OUTPUT_OPTIONS)
+    compileArgs = [arg for arg in compileArgs if arg not in OUTPUT_FLAGS]
+
+    # nvcc only preprocesses for a single GPU architecture. The device passes differ by
+    # __CUDA_ARCH__ only, and the architectures are part of the key.
+    #
+    preprocessArgs = compileArgs
+    if _isNvcc(compiler):
+        _, preprocessArgs = _splitOptions(compileArgs, ARCH_OPTIONS)
+
+    try:
+        preprocessed = subprocess.run(
+            [compiler, *preprocessArgs, "-E"], stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, check=True).stdout
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+    _, keyArgs = _splitOptions(compileArgs, PREPROCESSOR_OPTIONS)
+
+    hashObject = hashlib.sha256()
+    identities = [_fileIdentity(compiler)]
+    if _isNvcc(compiler):
+        identities.append(_fileIdentity(_getOptionValue(args, "-ccbin") or os.environ.get("CXX", "c++")))
+
+    hashObject.update(_replacePaths(repr([VERSION, identities, keyArgs]).encode('utf-8'), buildDir, baseDirs))
+    hashObject.update(_replacePaths(preprocessed, buildDir, baseDirs))
+    return hashObject.hexdigest()
+
+
+def runCompile(root, command, baseDirs=[]):
+    r'''Runs a compile command through the cache. Returns the exit code of the compile.'''
+    compiler, args = command[0], command[1:]
+    buildDir = os.getcwd()
+
+    key = makeKey(compiler, args, buildDir, baseDirs)
+    if key is None:
+        return _compile(command)
+
+    outputFile = _getOptionValue(args, "-o")
+    depFile = _getOptionValue(args, "-MF") or _getOptionValue(args, "--dependency-output")
+
+    entryPrefix = os.path.join(root, key[:2], key)
+    objectEntry, depEntry, stderrEntry = f"{entryPrefix}.o", f"{entryPrefix}.d", f"{entryPrefix}.stderr"
+
+    if os.path.exists(objectEntry) and (depFile is None or os.path.exists(depEntry)):
+        try:
+            if depFile is not None:
+                depContents = _restorePaths(_readFile(depEntry), buildDir, baseDirs)
+                depContents = depContents.replace(TARGET_PLACEHOLDER, outputFile.encode('utf-8'))
+                _writeFileAtomic(depFile, depContents)
+            _copyFileAtomic(objectEntry, outputFile)
+            os.utime(objectEntry)
+            if os.path.exists(stderrEntry):
+                sys.stderr.buffer.write(_readFile(stderrEntry))
+            return 0
+        except OSError:
+            pass
+
+    process = subprocess.run(command, stderr=subprocess.PIPE)
+    sys.stderr.buffer.write(process.stderr)
+    if process.returncode != 0:
+        return process.returncode
+
+    # The store may be shared or read-only. Failing to add an entry only costs a compile next time.
+    try:
+        os.makedirs(os.path.dirname(entryPrefix), exist_ok=True)
+        if depFile is not None:
+            depContents = _readFile(depFile)
+            depContents = depContents.replace(outputFile.encode('utf-8'), TARGET_PLACEHOLDER, 1)
+            depContents = _replacePaths(depContents, buildDir, baseDirs)
+            _writeFileAtomic(depEntry, depContents)
+        _writeFileAtomic(stderrEntry, process.stderr)
+        # The object is added last, it marks the entry as complete.
+        _copyFileAtomic(outputFile, objectEntry)
+    except OSError:
+        pass
+
+    return 0
+
+
+def splitModuleDefinition(sources):
+    r'''Returns the sources to build, with the module definition (PYBIND11_MODULE) of a host
+        source moved to a source of its own. The host source is replaced by a copy that defines
+        an init function instead. Both are written next to the host source, only if changed.
+    '''
+    newSources = []
+    for source in sources:
+        if not source.endswith(".cpp"):
+            newSources.append(source)
+            continue
+
+        with open(source, 'r', newline='') as f:
+            contents = f.read()
+
+        match = _PYBIND11_MODULE.search(contents)
+        if match is None:
+            newSources.append(source)
+            continue
+
+        # Same line count, so that diagnostics still match the generated source. Every module has
+        # an init function of the same name, hidden so that modules loaded into one process don't
+        # interpose on each other's (DLLs don't export it to begin with).
+        #
+        visibility = "" if sys.platform == "win32" else '__attribute__((visibility("hidden"))) '
+        hostContents = _PYBIND11_MODULE.sub(f"\\1{visibility}void {MODULE_INIT_FUNCTION}(pybind11::module_ \\2)", contents, count=1)
+
+        baseName = os.path.splitext(source)[0]
+        hostSource = f"{baseName}_slangtorch_host.cpp"
+        moduleSource = f"{baseName}{MODULE_SOURCE_SUFFIX}"
+        _writeFileIfChanged(hostSource, hostContents)
+        _writeFileIfChanged(moduleSource,
+            f"// Generated from {os.path.basename(source)}: the definition of the module, the only part\n"
+            f"// of the host source that depends on the module name.\n"
+            f"#include <pybind11/pybind11.h>\n"
+            f"\n"
+            f"{visibility}void {MODULE_INIT_FUNCTION}(pybind11::module_ m);\n"
+            f"\n"
+            f"PYBIND11_MODULE(TORCH_EXTENSION_NAME, m)\n"
+            f"{{\n"
+            f"    {MODULE_INIT_FUNCTION}(m);\n"
+            f"}}\n")
+        newSources.extend([hostSource, moduleSource])
+
+    return newSources
+
+
+def isModuleDefinitionFile(path):
+    r'''True for the sources written by splitModuleDefinition.'''
+    return path.endswith(("_slangtorch_host.cpp", MODULE_SOURCE_SUFFIX))
+
+
+def _writeFileIfChanged(path, contents):
+    # Leave the file (and its timestamp) alone if nothing changed, so that ninja doesn't rebuild.
+    if os.path.exists(path):
+        with open(path, 'r', newline='') as f:
+            if f.read() == contents:
+                return
+    tmpFile = f"{path}.{os.getpid()}.tmp"
+    with open(tmpFile, 'w', newline='') as f:
+        f.write(contents)
+    os.replace(tmpFile, path)
+
+
+def enableObjectCache(buildFile, root, baseDirs=[]):
+    r'''Rewrites the compiler variables of a build.ninja written by torch to run through the
+        object cache in root. Paths under baseDirs (innermost first) are left out of the cache
+        keys.
+    '''
+    with open(buildFile, 'r') as f:
+        lines = f.read().splitlines(keepends=True)
+
+    launcherArgs = [sys.executable, os.path.abspath(__file__), root]
+    launcherArgs.extend(f"{BASE_DIR_OPTION}={baseDir}" for baseDir in baseDirs)
+    launcher = " ".join(shlex.quote(arg) for arg in launcherArgs)
+    for i, line in enumerate(lines):
+        name, sep, value = line.partition(" = ")
+        if sep and name in ("cxx", "nvcc") and not value.startswith(launcher):
+            lines[i] = f"{name} = {launcher} {value}"
+
+    with open(buildFile, 'w') as f:
+        f.write("".join(lines))
+
+
+def isolateModuleName(buildFile):
+    r'''Rewrites a build.ninja written by torch so that only the module definition sources
+        (see splitModuleDefinition) are compiled with the module name define. The commands of
+        the other sources then don't change with the build ID, and a build directory cloned
+        for a new build only recompiles the sources that changed.
+    '''
+    with open(buildFile, 'r') as f:
+        lines = f.read().splitlines(keepends=True)
+
+    nameFlags = []
+    for i, line in enumerate(lines):
+        name, sep, value = line.partition(" = ")
+        if sep and name in ("cflags", "cuda_cflags"):
+            flags = value.rstrip("\n").split(" ")
+            nameFlags.extend(flag for flag in flags if flag.startswith(MODULE_NAME_FLAGS) and flag not in nameFlags)
+            lines[i] = f"{name} = {' '.join(flag for flag in flags if not flag.startswith(MODULE_NAME_FLAGS))}\n"
+
+    if not nameFlags:
+        return
+
+    newLines = []
+    for line in lines:
+        newLines.append(line)
+        if line.startswith("build ") and line.rstrip().endswith(MODULE_SOURCE_SUFFIX):
+            newLines.append(f"  cflags = $cflags {' '.join(nameFlags)}\n")
+
+    with open(buildFile, 'w') as f:
+        f.write("".join(newLines))
+
+
+def trimObjectCache(root, maxSizeBytes):
+    r'''Removes the least recently used entries until the store is below 90% of maxSizeBytes.'''
+    entries = []
+    totalSize = 0
+    for dirPath, _, fileNames in os.walk(root):
+        for fileName in fileNames:
+            if not fileName.endswith(".o"):
+                continue
+            prefix = os.path.join(dirPath, fileName[:-2])
+            try:
+                size = sum(os.path.getsize(prefix + ext) for ext in (".o", ".d", ".stderr") if os.path.exists(prefix + ext))
+                entries.append((os.path.getmtime(prefix + ".o"), size, prefix))
+            except OSError:
+                continue
+            totalSize += size
+
+    if totalSize <= maxSizeBytes:
+        return 0
+
+    removed = 0
+    for _, size, prefix in sorted(entries):
+        if totalSize <= maxSizeBytes * 9 // 10:
+            break
+        for ext in (".o", ".d", ".stderr"):
+            try:
+                os.remove(prefix + ext)
+            except OSError:
+                pass
+        totalSize -= size
+        removed += 1
+    return removed
+
+
+if __name__ == "__main__":
+    baseDirs = []
+    arguments = sys.argv[2:]
+    while arguments and arguments[0].startswith(BASE_DIR_OPTION + "="):
+        baseDirs.append(arguments.pop(0)[len(BASE_DIR_OPTION) + 1:])
+    if len(sys.argv) < 3 or not arguments:
+        print(f"usage: {sys.argv[0]} <cache dir> [{BASE_DIR_OPTION}=<dir>...] <compiler> [args...]", file=sys.stderr)
+        sys.exit(2)
+    sys.exit(runCompile(sys.argv[1], arguments, baseDirs))
@@ -0,0 +1,353 @@
+#
+# Precompiled Slang prelude for the generated host (torch-binding) sources.
+#
+# A generated host source is the Slang C++ prelude (including the torch headers), followed by a
+# short module-specific part starting at '#define SLANG_PRELUDE_EXPORT'. The prelude is written
+# to a shared header that is precompiled once for each prelude/flags combination, and the module
+# is compiled from a small source that includes it.
+#
+# Only GCC picks up a precompiled header (prelude.h.gch) through a plain #include, other host
+# compilers compile the module source as is.
+#
+# Optionally, the out-of-line definitions of the prelude (make_tensor_view, the f16 conversions)
+# are built once into a shared library that modules link against, and the precompiled header 
+# only declares them. The library is compiled from the unmodified prelude, and is only used if
+# it exports every function whose body was left out of the header. Modules load it from their
+# own build directory, where it is copied next to the module binary.
+#
+# Layout:
+#   <pchRoot>/<key>/prelude.h           Prelude of the generated host source
+#   <pchRoot>/<key>/prelude.h.gch       Precompiled prelude. Built with ninja, which tracks the
+#   <pchRoot>/<key>/build.ninja         headers it depends on.
+#   <pchRoot>/<key>/prelude_lib.cpp     Definitions of the prelude, and the shared library
+#   <pchRoot>/<key>/libslangtorch_prelude_<key>.so
+#
+
+import os
+import re
+import sys
+import json
+import shlex
+import hashlib
+import tempfile
+import subprocess
+from filelock import FileLock
+
+from .compile import get_host_compile_flags, run_ninja, NinjaResult
+from .clone import copyFile
+
+PRELUDE_END_MARKER = "#define SLANG_PRELUDE_EXPORT"
+
+# Precompiled preludes that failed to build in this process. These are not retried.
+_failedKeys = set()
+
+# Host compile flags, per set of extra flags and include paths.
+_hostCompileFlags = {}
+
+# Whether a host compiler is GCC, per compiler command.
+_isGccCompiler = {}
+
+# Flags for the sources that include a precompiled header. A header that exists but can't be 
+# used (e.g. built with different flags) is silently compiled from source otherwise.
+#
+PCH_CFLAGS = ["-Winvalid-pch"]
+
+
+def splitHostSource(hostSource):
+    r'''Returns (prelude, moduleSource, moduleStartLine) for a generated host source,
+        or None if it doesn't have the expected prelude.
+    '''
+    with open(hostSource, 'r', newline='') as f:
+        lines = f.read().splitlines(keepends=True)
+
+    for i, line in enumerate(lines):
+        if line.rstrip() == PRELUDE_END_MARKER:
+            return ''.join(lines[:i]), ''.join(lines[i:]), i + 1
+
+    return None
+
+
+# Out-of-line function definitions at the start of a line, with the body starting on the next line.
+# Templates and functions with internal or inline linkage are left in place.
+#
+_FUNCTION_DEFINITION = re.compile(
+    r'^(?!(?:template|static|inline|SLANG_FORCE_INLINE|SLANG_INLINE|constexpr|struct|class|union|enum|'
+    r'typedef|using|namespace|return|extern|friend|virtual|explicit)\b)'
+    r'[A-Za-z_][\w:<>,\s\*&]*?[\s\*&]([A-Za-z_]\w*)\s*\([^;{}]*\)\s*(const\s*)?$')
+
+
+def splitPreludeDefinitions(prelude):
+    r'''Returns (declarations, names): the prelude with the bodies of its out-of-line functions
+        replaced by declarations, and the names of those functions.
+    '''
+    lines = prelude.splitlines(keepends=True)
+    result = []
+    names = []
+    i = 0
+    while i < len(lines):
+        line = lines[i]
+        match = _FUNCTION_DEFINITION.match(line)
+        if match and i + 1 < len(lines) and lines[i + 1].rstrip() == '{':
+            previous = next((l.strip() for l in reversed(result) if l.strip()), '')
+            if not (previous.startswith('template') or previous.endswith(('\\', ',', '(')) or 
+                    previous in ('SLANG_FORCE_INLINE', 'inline')):
+                end = next((j for j in range(i + 2, len(lines)) if lines[j].rstrip() == '}'), None)
+                if end is not None:
+                    result.append(line.rstrip() + ';\n')
+                    # Keep the line count, so that line numbers still match the generated source.
+                    result.extend(['\n'] * (end - i))
+                    names.append(match.group(1))
+                    i = end + 1
+                    continue
+        result.append(line)
+        i += 1
+
+    return ''.join(result), names
+
+
+def writeFileIfChanged(path, contents):
+    # Leave the file (and its timestamp) alone if nothing changed, so that ninja doesn't rebuild.
+    if os.path.exists(path):
+        with open(path, 'r', newline='') as f:
+            if f.read() == contents:
+                return False
+
+    tmpFile = f"{path}.{os.getpid()}.tmp"
+    with open(tmpFile, 'w', newline='') as f:
+        f.write(contents)
+    os.replace(tmpFile, path)
+    return True
+
+
+def _getHostCompileFlags(extraCflags, extraIncludePaths):
+    flagsKey = json.dumps([extraCflags, extraIncludePaths])
+    if flagsKey not in _hostCompileFlags:
+        with tempfile.TemporaryDirectory() as flagsDir:
+            _hostCompileFlags[flagsKey] = get_host_compile_flags(flagsDir, extraCflags, extraIncludePaths)
+    return _hostCompileFlags[flagsKey]
+
+
+def isGccCompiler(cxx):
+    r'''True if the host compiler command is GCC (and not clang, which also answers to g++/c++).'''
+    if cxx not in _isGccCompiler:
+        try:
+            output = subprocess.run(shlex.split(cxx) + ['--version'], stdout=subprocess.PIPE,
+                                    stderr=subprocess.STDOUT, timeout=30).stdout.decode('utf-8', errors='replace')
+        except (OSError, ValueError, subprocess.SubprocessError):
+            output = ""
+        _isGccCompiler[cxx] = 'Free Software Foundation' in output and 'clang' not in output.lower()
+    return _isGccCompiler[cxx]
+
+
+def getExportedFunctionNames(libraryPath):
+    r'''Returns the unqualified names of the functions defined by a shared library, or None if
+        they can't be listed.
+    '''
+    try:
+        result = subprocess.run(['nm', '-D', '-C', '--defined-only', libraryPath], stdout=subprocess.PIPE,
+                                stderr=subprocess.DEVNULL, timeout=60)
+    except (OSError, subprocess.SubprocessError):
+        return None
+    if result.returncode != 0:
+        return None
+
+    names = set()
+    for line in result.stdout.decode('utf-8', errors='replace').splitlines():
+        # <address> <type> <demangled name>(<parameters>)
+        parts = line.split(None, 2)
+        if len(parts) == 3 and parts[1] in ('T', 'W') and '(' in parts[2]:
+            names.add(parts[2].split('(', 1)[0].split('::')[-1].strip())
+    return names
+
+
+def getPreludeLibraryName(key):
+    return f"libslangtorch_prelude_{key}.so"
+
+
+def _makePchBuildFile(flags, libraryName=None):
+    buildFile = (
+        "ninja_required_version = 1.3\n"
+        f"cxx = {flags['cxx']}\n"
+        "\n"
+        f"cflags = {flags['cflags']}\n"
+        f"post_cflags = {flags['post_cflags']}\n"
+        f"ldflags = {flags['ldflags']}\n"
+        "\n"
+        "rule pch\n"
+        "  command = $cxx -MMD -MF $out.d -x c++-header $cflags -c $in -o $out $post_cflags\n"
+        "  depfile = $out.d\n"
+        "  deps = gcc\n"
+        "\n"
+        "build prelude.h.gch: pch prelude.h\n")
+
+    if libraryName is None:
+        return buildFile + "\ndefault prelude.h.gch\n"
+
+    # The library's symbols must be visible to the modules, whatever the default visibility is.
+    return buildFile + (
+        "\n"
+        "rule compile\n"
+        "  command = $cxx -MMD -MF $out.d $cflags -fvisibility=default -c $in -o $out $post_cflags\n"
+        "  depfile = $out.d\n"
+        "  deps = gcc\n"
+        "\n"
+        "rule link\n"
+        "  command = $cxx $in $ldflags -Wl,-soname,$soname -o $out\n"
+        "\n"
+        "build prelude_lib.o: compile prelude_lib.cpp\n"
+        f"build {libraryName}: link prelude_lib.o\n"
+        f"  soname = {libraryName}\n"
+        "\n"
+        f"default prelude.h.gch {libraryName}\n")
+
+
+def buildPrecompiledPrelude(pchRoot, prelude, extraCflags, extraIncludePaths, toolchainFingerprint, sharedLibrary=False, verbose=False):
+    r'''Builds (or reuses) the precompiled header for a prelude. Returns (header, ldflags, library):
+        the path of the header to include, and the link flags and path of the shared prelude
+        library (if sharedLibrary is set and the prelude has out-of-line definitions). Returns
+        None if it couldn't be built.
+    '''
+    flags = _getHostCompileFlags(extraCflags, extraIncludePaths)
+    if not flags['cxx'] or not isGccCompiler(flags['cxx']):
+        if verbose:
+            print(f"Not using a precompiled prelude, the host compiler ({flags['cxx']}) is not GCC.", file=sys.stderr)
+        return None
+
+    # pchRoot is specific to a source directory already. Leaving the include paths (the source
+    # directory) out of the key gives the header the same path relative to every source 
+    # directory, so the object cache can share the sources that include it.
+    #
+    keyFlags = json.dumps(flags)
+    for index, includePath in enumerate(extraIncludePaths or []):
+        keyFlags = keyFlags.replace(json.dumps(includePath)[1:-1], f"<include{index}>")
+    key = hashlib.sha256(json.dumps([
+        hashlib.sha256(prelude.encode('utf-8')).hexdigest(),
+        keyFlags, toolchainFingerprint, sharedLibrary], sort_keys=True).encode()).hexdigest()[:16]
+    if key in _failedKeys:
+        return None
+
+    pchDir = os.path.join(pchRoot, key)
+
+    header = prelude
+    libraryName = None
+    names = []
+    if sharedLibrary and ' ' not in pchDir:
+        declarations, names = splitPreludeDefinitions(prelude)
+        if names:
+            header = declarations
+            libraryName = getPreludeLibraryName(key)
+
+    os.makedirs(pchDir, exist_ok=True)
+
+    # Modules built concurrently (in this or other processes) share the header.
+    with FileLock(os.path.join(pchRoot, f"{key}.lock")):
+        writeFileIfChanged(os.path.join(pchDir, "prelude.h"), header)
+        if libraryName is not None:
+            writeFileIfChanged(os.path.join(pchDir, "prelude_lib.cpp"), prelude)
+        writeFileIfChanged(os.path.join(pchDir, "build.ninja"), _makePchBuildFile(flags, libraryName))
+
+        if verbose:
+            print(f"Building precompiled prelude in {pchDir}", file=sys.stderr)
+
+        try:
+            result = run_ninja(pchDir, verbose=verbose, jobs=1 if libraryName is None else 2)
+        except OSError:
+            result = NinjaResult.BUILD_FAIL
+
+        if result == NinjaResult.BUILD_FAIL:
+            print(f"Warning: failed to build the precompiled prelude in {pchDir}. "
+                  f"Compiling without it.", file=sys.stderr)
+            _failedKeys.add(key)
+            return None
+
+    if libraryName is None:
+        return os.path.join(pchDir, "prelude.h"), [], None
+
+    # The header declares the functions whose bodies were split off. If the split missed or
+    # misread a definition, the library doesn't export them all, and isn't used.
+    #
+    libraryPath = os.path.join(pchDir, libraryName)
+    exportedNames = getExportedFunctionNames(libraryPath)
+    missingNames = sorted(set(names) - exportedNames) if exportedNames is not None else names
+    if missingNames:
+        if verbose:
+            print(f"Not using the shared prelude library in {pchDir}, it doesn't define "
+                  f"{', '.join(missingNames)}.", file=sys.stderr)
+        _failedKeys.add(key)
+        return None
+
+    # Loaded from the directory of the module binary, not from the precompiled prelude's. '$$' 
+    # is ninja's escape, the quotes keep the shell from expanding $ORIGIN.
+    #
+    ldflags = [f"-L{pchDir}", f"-l:{libraryName}", "-Wl,-rpath,'$$ORIGIN'"]
+    return os.path.join(pchDir, "prelude.h"), ldflags, libraryPath
+
+
+def _copyLibrary(libraryPath, libraryDir):
+    # Replace rather than overwrite: a loaded copy must not change under a running process.
+    targetPath = os.path.join(libraryDir, os.path.basename(libraryPath))
+    if os.path.exists(targetPath):
+        source, target = os.stat(libraryPath), os.stat(targetPath)
+        if (source.st_size, source.st_mtime) == (target.st_size, target.st_mtime):
+            return
+    os.makedirs(libraryDir, exist_ok=True)
+    tmpPath = f"{targetPath}.{os.getpid()}.tmp"
+    copyFile(libraryPath, tmpPath)
+    os.replace(tmpPath, targetPath)
+
+
+def getPrecompiledPreludeSources(sources, pchRoot, extraCflags, extraIncludePaths, toolchainFingerprint, sharedLibrary=False, libraryDir=None, verbose=False):
+    r'''Returns (sources, cflags, ldflags): the sources to build, with each generated host source 
+        replaced by one that includes its prelude from a precompiled header, and the extra compile
+        flags and the link flags for the shared prelude library. Sources that can't use a 
+        precompiled header are returned unchanged.
+
+        The shared prelude library is copied to libraryDir, the directory of the module binary.
+    '''
+    newSources = []
+    pchCflags = []
+    extraLdflags = []
+    for source in sources:
+        split = splitHostSource(source) if source.endswith(".cpp") else None
+        header = None
+        if split is not None:
+            prelude, moduleSource, moduleStartLine = split
+            result = None
+            if sharedLibrary and libraryDir is not None:
+                result = buildPrecompiledPrelude(pchRoot, prelude, extraCflags, extraIncludePaths, toolchainFingerprint, True, verbose)
+            if result is None:
+                result = buildPrecompiledPrelude(pchRoot, prelude, extraCflags, extraIncludePaths, toolchainFingerprint, False, verbose)
+            if result is not None:
+                header, ldflags, libraryPath = result
+                extraLdflags.extend(ldflags)
+                if libraryPath is not None:
+                    _copyLibrary(libraryPath, libraryDir)
+
+        if header is None:
+            newSources.append(source)
+            continue
+
+        # Report diagnostics against the lines of the original source.
+        pchSource = os.path.splitext(source)[0] + "_pch.cpp"
+        writeFileIfChanged(pchSource,
+            f"// Generated from {os.path.basename(source)}, with the prelude included from a precompiled header.\n"
+            f"#include \"{header.replace(os.sep, '/')}\"\n"
+            f"#line {moduleStartLine} \"{source.replace(os.sep, '/')}\"\n"
+            f"{moduleSource}")
+        newSources.append(pchSource)
+        pchCflags = PCH_CFLAGS
+
+    return newSources, pchCflags, extraLdflags
+
+
+def isPrecompiledPreludeFile(path, pchRoot):
+    r'''True for files derived from a generated host source (precompiled headers, and the
+        sources that include them).
+    '''
+    path = os.path.realpath(path)
+    if path.endswith("_pch.cpp"):
+        return True
+    try:
+        return os.path.commonpath([path, os.path.realpath(pchRoot)]) == os.path.realpath(pchRoot)
+    except ValueError:
+        return False
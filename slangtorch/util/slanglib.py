@@ -0,0 +1,75 @@
+#
+# In-process Slang compiler backend. Loads the Slang shared library once per process
+# and drives it through the C API, instead of spawning a slangc process per compile.
+#
+
+import ctypes
+import threading
+
+
+class SlangLibraryCompiler(object):
+    def __init__(self, libraryPath) -> None:
+        self.libraryPath = libraryPath
+        self.lib = ctypes.CDLL(libraryPath)
+
+        lib = self.lib
+        lib.spCreateSession.restype = ctypes.c_void_p
+        lib.spCreateSession.argtypes = [ctypes.c_char_p]
+        lib.spCreateCompileRequest.restype = ctypes.c_void_p
+        lib.spCreateCompileRequest.argtypes = [ctypes.c_void_p]
+        lib.spDestroyCompileRequest.restype = None
+        lib.spDestroyCompileRequest.argtypes = [ctypes.c_void_p]
+        lib.spSetCommandLineCompilerMode.restype = None
+        lib.spSetCommandLineCompilerMode.argtypes = [ctypes.c_void_p]
+        lib.spProcessCommandLineArguments.restype = ctypes.c_int32
+        lib.spProcessCommandLineArguments.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_char_p), ctypes.c_int]
+        lib.spCompile.restype = ctypes.c_int32
+        lib.spCompile.argtypes = [ctypes.c_void_p]
+        lib.spGetDiagnosticOutput.restype = ctypes.c_char_p
+        lib.spGetDiagnosticOutput.argtypes = [ctypes.c_void_p]
+        lib.spGetDependencyFileCount.restype = ctypes.c_int
+        lib.spGetDependencyFileCount.argtypes = [ctypes.c_void_p]
+        lib.spGetDependencyFilePath.restype = ctypes.c_char_p
+        lib.spGetDependencyFilePath.argtypes = [ctypes.c_void_p, ctypes.c_int]
+
+        # The global session loads the core module once, and is reused by every compile.
+        self.session = lib.spCreateSession(None)
+        if not self.session:
+            raise RuntimeError(f"Failed to create a Slang session from {libraryPath}")
+
+        # Compile requests on the same session must not run concurrently.
+        self.lock = threading.Lock()
+
+    def compile(self, args):
+        r'''Compiles with slangc-style command-line arguments (without the executable name).
+            Output files named on the command line are written as slangc would.
+
+            Returns (returnCode, diagnostics, dependencyFiles)
+        '''
+        with self.lock:
+            request = self.lib.spCreateCompileRequest(self.session)
+            if not request:
+                raise RuntimeError("Failed to create a Slang compile request")
+
+            try:
+                self.lib.spSetCommandLineCompilerMode(request)
+
+                encodedArgs = [arg.encode('utf-8') for arg in args]
+                argv = (ctypes.c_char_p * len(encodedArgs))(*encodedArgs)
+                result = self.lib.spProcessCommandLineArguments(request, argv, len(encodedArgs))
+                if result >= 0:
+                    result = self.lib.spCompile(request)
+
+                diagnostics = self.lib.spGetDiagnosticOutput(request)
+                diagnostics = diagnostics.decode('utf-8') if diagnostics else ""
+
+                dependencyFiles = []
+                if result >= 0:
+                    for i in range(self.lib.spGetDependencyFileCount(request)):
+                        path = self.lib.spGetDependencyFilePath(request, i)
+                        if path:
+                            dependencyFiles.append(path.decode('utf-8'))
+
+                return (0 if result >= 0 else result), diagnostics, dependencyFiles
+            finally:
+                self.lib.spDestroyCompileRequest(request)
@@ -0,0 +1,153 @@
+#
+# Merges the generated sources of several variants (sets of defines) of a Slang module into one
+# host source and one CUDA source, so that a sweep over variants is compiled and linked once,
+# into a single extension module.
+#
+# The generated sources of all variants start with the same prelude, which is emitted once. The
+# rest of each variant goes into its own namespace. Symbols with C linkage ignore namespaces, and
+# are renamed per variant in both sources. The host binding of each variant is registered on a
+# submodule 'variant_<i>' of the extension module, in the order the variants were given.
+#
+# Variants with identical generated sources share a namespace.
+#
+
+import re
+
+from .pch import PRELUDE_END_MARKER, writeFileIfChanged
+
+VARIANT_NAMESPACE = "slangtorch_variant_{}"
+VARIANT_SUBMODULE = "variant_{}"
+VARIANT_INIT_FUNCTION = "slangtorch_init_variant"
+
+_PYBIND11_MODULE = re.compile(r'^(\s*)PYBIND11_MODULE\s*\(\s*\w+\s*,\s*(\w+)\s*\)', re.MULTILINE)
+_EXTERN_C_DECLARATION = re.compile(r'extern\s+"C"\s+[^;{}()]*?\b([A-Za-z_]\w*)\s*\(')
+_INCLUDE = re.compile(r'^\s*#\s*include\b')
+_CONDITIONAL_START = re.compile(r'^\s*#\s*if')
+_CONDITIONAL_END = re.compile(r'^\s*#\s*endif\b')
+
+# Module-specific code that must not be shared by the variants.
+_VARIANT_START = re.compile(r'^\s*[^#\s].*(?:PYBIND11_MODULE|extern\s+"C"|__global__)')
+
+
+def _stripLiterals(line):
+    # Drops comments and string/character literals, for brace counting.
+    line = re.sub(r'"(?:\\.|[^"\\])*"|\'(?:\\.|[^\'\\])*\'', '""', line)
+    return line.split('//', 1)[0]
+
+
+def _getTopLevelLines(lines):
+    r'''Returns the indices of the lines after which no brace or preprocessor conditional is open.'''
+    topLevel = []
+    braceDepth = 0
+    conditionalDepth = 0
+    for i, line in enumerate(lines):
+        if _CONDITIONAL_START.match(line):
+            conditionalDepth += 1
+        elif _CONDITIONAL_END.match(line):
+            conditionalDepth -= 1
+        elif not line.lstrip().startswith('#'):
+            code = _stripLiterals(line)
+            braceDepth += code.count('{') - code.count('}')
+        if braceDepth == 0 and conditionalDepth == 0:
+            topLevel.append(i)
+    return topLevel
+
+
+def _splitCommonPrefix(sources, isHost):
+    r'''Returns (prefix, [rest of each source]), where prefix is the longest common prefix of
+        sources that ends at the top level, before any module-specific code.
+    '''
+    sourceLines = [source.splitlines(keepends=True) for source in sources]
+    first = sourceLines[0]
+
+    length = 0
+    while (length < len(first) and all(length < len(lines) and lines[length] == first[length] for lines in sourceLines)
+           and not _VARIANT_START.search(first[length])
+           and not (isHost and first[length].rstrip() == PRELUDE_END_MARKER)):
+        length += 1
+
+    # Back off to the end of a top-level declaration.
+    topLevel = [i + 1 for i in _getTopLevelLines(first[:length])]
+    length = max([0] + topLevel)
+
+    return ''.join(first[:length]), [''.join(lines[length:]) for lines in sourceLines]
+
+
+def _hoistIncludes(source):
+    # Includes that are not nested in a conditional are moved out of the variant's namespace.
+    lines = source.splitlines(keepends=True)
+    topLevel = set(i + 1 for i in _getTopLevelLines(lines))
+    topLevel.add(0)
+
+    includes = []
+    for i, line in enumerate(lines):
+        if i in topLevel and _INCLUDE.match(line):
+            includes.append(line)
+            lines[i] = '\n'
+    return ''.join(includes), ''.join(lines)
+
+
+def _renameSymbols(source, names, suffix):
+    if not names:
+        return source
+    pattern = re.compile(r'\b(' + '|'.join(re.escape(name) for name in sorted(names)) + r')\b')
+    return pattern.sub(lambda match: match.group(1) + suffix, source)
+
+
+def mergeVariantSources(hostSources, cudaSources, hostOutputFile, cudaOutputFile):
+    r'''Merges the generated sources of the variants (one host and one CUDA source per variant)
+        into hostOutputFile and cudaOutputFile. Files are only written if their contents changed.
+    '''
+    hostContents = []
+    cudaContents = []
+    for hostSource, cudaSource in zip(hostSources, cudaSources):
+        with open(hostSource, 'r', newline='') as f:
+            hostContents.append(f.read())
+        with open(cudaSource, 'r', newline='') as f:
+            cudaContents.append(f.read())
+
+    # Variants whose generated sources are identical are built once.
+    uniqueVariants = []
+    variantIndices = []
+    for contents in zip(hostContents, cudaContents):
+        if contents not in uniqueVariants:
+            uniqueVariants.append(contents)
+        variantIndices.append(uniqueVariants.index(contents))
+
+    hostPrefix, hostParts = _splitCommonPrefix([host for host, _ in uniqueVariants], isHost=True)
+    cudaPrefix, cudaParts = _splitCommonPrefix([cuda for _, cuda in uniqueVariants], isHost=False)
+
+    hostIncludes, cudaIncludes = [], []
+    hostBodies, cudaBodies = [], []
+    for index, (hostPart, cudaPart) in enumerate(zip(hostParts, cudaParts)):
+        if not _PYBIND11_MODULE.search(hostPart):
+            raise RuntimeError(f"Could not find the module definition in the host source of variant {index}")
+
+        namespace = VARIANT_NAMESPACE.format(index)
+        externNames = set(_EXTERN_C_DECLARATION.findall(hostPart)) | set(_EXTERN_C_DECLARATION.findall(cudaPart))
+
+        # The prelude ends with a marker that must stay at the top level (see pch.py).
+        hostPart = "".join('\n' if line.rstrip() == PRELUDE_END_MARKER else line
+                           for line in hostPart.splitlines(keepends=True))
+        hostPart = _PYBIND11_MODULE.sub(f"\\1void {VARIANT_INIT_FUNCTION}(pybind11::module_ \\2)", hostPart, count=1)
+        includes, hostPart = _hoistIncludes(_renameSymbols(hostPart, externNames, f"_{namespace}"))
+        hostIncludes.append(includes)
+        hostBodies.append(f"namespace {namespace} {{\n{hostPart}\n}} // namespace {namespace}\n")
+
+        includes, cudaPart = _hoistIncludes(_renameSymbols(cudaPart, externNames, f"_{namespace}"))
+        cudaIncludes.append(includes)
+        cudaBodies.append(f"namespace {namespace} {{\n{cudaPart}\n}} // namespace {namespace}\n")
+
+    registration = "".join(
+        f"    {VARIANT_NAMESPACE.format(index)}::{VARIANT_INIT_FUNCTION}(m.def_submodule(\"{VARIANT_SUBMODULE.format(variant)}\"));\n"
+        for variant, index in enumerate(variantIndices))
+
+    hostIncludes = "".join(dict.fromkeys("".join(hostIncludes).splitlines(keepends=True)))
+    cudaIncludes = "".join(dict.fromkeys("".join(cudaIncludes).splitlines(keepends=True)))
+
+    hostSource = (hostPrefix + hostIncludes + PRELUDE_END_MARKER + "\n" + "".join(hostBodies) +
+                  f"\nPYBIND11_MODULE(TORCH_EXTENSION_NAME, m)\n{{\n{registration}}}\n")
+    cudaSource = cudaPrefix + cudaIncludes + "".join(cudaBodies)
+
+    writeFileIfChanged(hostOutputFile, hostSource)
+    writeFileIfChanged(cudaOutputFile, cudaSource)
@@ -0,0 +1,171 @@
+#
+# Watches a set of files for changes on a background thread. Uses inotify on Linux (watching the
+# parent directories, so that editors that replace files by renaming are handled), and polls
+# modification times elsewhere.
+#
+
+import os
+import sys
+import time
+import struct
+import select
+import threading
+
+try:
+    import ctypes
+    import ctypes.util
+except ImportError:
+    ctypes = None
+
+# From sys/inotify.h
+IN_ATTRIB = 0x00000004
+IN_CLOSE_WRITE = 0x00000008
+IN_MOVED_TO = 0x00000080
+IN_CREATE = 0x00000100
+IN_DELETE = 0x00000200
+IN_Q_OVERFLOW = 0x00004000
+WATCH_MASK = IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE
+
+_EVENT_HEADER = struct.Struct("iIII")
+
+# Time to wait for more changes after the first one, so that saving several files (or an
+# editor writing a file in several steps) triggers a single rebuild.
+#
+DEBOUNCE_SECONDS = 0.1
+
+
+def _loadInotify():
+    if ctypes is None or not sys.platform.startswith("linux"):
+        return None
+    try:
+        libc = ctypes.CDLL(ctypes.util.find_library("c") or "libc.so.6", use_errno=True)
+        libc.inotify_init1.argtypes = [ctypes.c_int]
+        libc.inotify_add_watch.argtypes = [ctypes.c_int, ctypes.c_char_p, ctypes.c_uint32]
+        libc.inotify_rm_watch.argtypes = [ctypes.c_int, ctypes.c_int]
+        return libc
+    except (OSError, AttributeError):
+        return None
+
+
+class FileWatcher(object):
+    r'''Calls onChange(changedPaths) on a background thread when any of the watched files is
+        written, replaced, created or removed. onChange may return a new set of paths to watch.
+    '''
+    def __init__(self, paths, onChange, pollInterval=0.5) -> None:
+        self.onChange = onChange
+        self.pollInterval = pollInterval
+        self.paths = set()
+        self._stopped = threading.Event()
+
+        self._libc = _loadInotify()
+        self._fd = None
+        self._watches = {}
+        if self._libc is not None:
+            fd = self._libc.inotify_init1(os.O_NONBLOCK | os.O_CLOEXEC)
+            if fd >= 0:
+                self._fd = fd
+
+        self._mtimes = {}
+        self.setPaths(paths)
+
+        self._thread = threading.Thread(target=self._run, name="slangtorch-watch", daemon=True)
+        self._thread.start()
+
+    @property
+    def usesInotify(self):
+        return self._fd is not None
+
+    def setPaths(self, paths):
+        self.paths = set(os.path.realpath(path) for path in paths)
+        if self._fd is not None:
+            directories = set(os.path.dirname(path) for path in self.paths)
+            for directory, wd in list(self._watches.items()):
+                if directory not in directories:
+                    self._libc.inotify_rm_watch(self._fd, wd)
+                    del self._watches[directory]
+            for directory in directories - set(self._watches):
+                wd = self._libc.inotify_add_watch(self._fd, directory.encode(), WATCH_MASK)
+                if wd >= 0:
+                    self._watches[directory] = wd
+        self._mtimes = dict((path, self._getMtime(path)) for path in self.paths)
+
+    def stop(self):
+        self._stopped.set()
+        if self._thread is not threading.current_thread():
+            self._thread.join()
+
+    @staticmethod
+    def _getMtime(path):
+        try:
+            stat = os.stat(path)
+            return (stat.st_mtime_ns, stat.st_size)
+        except OSError:
+            return None
+
+    def _readInotifyEvents(self, timeout):
+        readable, _, _ = select.select([self._fd], [], [], timeout)
+        if not readable:
+            return set()
+
+        try:
+            data = os.read(self._fd, 65536)
+        except BlockingIOError:
+            return set()
+
+        directories = dict((wd, directory) for directory, wd in self._watches.items())
+        changed = set()
+        offset = 0
+        while offset + _EVENT_HEADER.size <= len(data):
+            wd, mask, _, nameLength = _EVENT_HEADER.unpack_from(data, offset)
+            offset += _EVENT_HEADER.size
+            name = data[offset:offset + nameLength].rstrip(b"\0").decode(errors="replace")
+            offset += nameLength
+
+            if mask & IN_Q_OVERFLOW:
+                # Events were dropped, assume everything changed.
+                changed.update(self.paths)
+            elif wd in directories:
+                path = os.path.join(directories[wd], name)
+                if path in self.paths:
+                    changed.add(path)
+        return changed
+
+    def _pollChanges(self, timeout):
+        self._stopped.wait(timeout)
+        changed = set()
+        for path in self.paths:
+            mtime = self._getMtime(path)
+            if mtime != self._mtimes.get(path):
+                self._mtimes[path] = mtime
+                changed.add(path)
+        return changed
+
+    def _waitForChanges(self, timeout):
+        if self._fd is not None:
+            return self._readInotifyEvents(timeout)
+        return self._pollChanges(timeout)
+
+    def _run(self):
+        try:
+            while not self._stopped.is_set():
+                changed = self._waitForChanges(self.pollInterval)
+                if not changed:
+                    continue
+
+                # Collect the rest of a burst of changes.
+                while True:
+                    more = self._waitForChanges(DEBOUNCE_SECONDS)
+                    if not more:
+                        break
+                    changed |= more
+
+                if self._stopped.is_set():
+                    break
+
+                newPaths = self.onChange(changed)
+                if newPaths is not None:
+                    self.setPaths(newPaths)
+        finally:
+            if self._fd is not None:
+                os.close(self._fd)
+                self._fd = None
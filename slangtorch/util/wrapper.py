@@ -48,7 +48,7 @@ class LaunchableObject(object):
             print("\033[0m", end="")
         
 class WrappedFunction(object):
-    def __init__(self, fn_name, fn_handle, argnames, argwrappers, fwd_wrapped_fn = None, bwd_wrapped_fn = None) -> None:
+    def __init__(self, fn_name, fn_handle, argnames, argwrappers, fwd_wrapped_fn = None, bwd_wrapped_fn = None, specializer = None) -> None:
         self.fn_handle = fn_handle
         self.fn_name = fn_name
         self.argnames = argnames
@@ -57,6 +57,9 @@ class WrappedFunction(object):
         self.fwd_wrapped_fn = fwd_wrapped_fn
         self.bwd_wrapped_fn = bwd_wrapped_fn
 
+        # Routes calls to builds specialized for the shapes of the arguments, if any.
+        self.specializer = specializer
+
     def kwargs_to_arglist(self, **kwargs):
         arglist = []
         missing_from_input = []
@@ -92,9 +95,14 @@ class WrappedFunction(object):
                 "Available arguments: " + str(self.argnames))
         
         arglist = tuple(self.kwargs_to_arglist(**kwargs))
+
+        fn_handle = self.fn_handle
+        if self.specializer is not None:
+            fn_handle = self.specializer.getFunction(self.fn_name, self.argnames, arglist) or fn_handle
+
         arglist = self.process_arglist(arglist)
         return LaunchableObject(
-            lambda blockSize, gridSize: self.fn_handle(*((blockSize, gridSize) + arglist)),
+            lambda blockSize, gridSize: fn_handle(*((blockSize, gridSize) + arglist)),
             name=self.fn_name)
 
     def fwd(self, *args, **kwargs):
@@ -161,7 +169,7 @@ def makeTypeWrapper(module, typename, wrappedTypeMap):
         # TODO: Make this more robust (we may have basic types too)
         return torch.Tensor, lambda x: x
 
-def wrapModule(module):
+def wrapModule(module, specializer=None):
     attributes = dict()
     processed = set()
     wrapperTypeMap = dict()
@@ -188,12 +196,12 @@ def wrapModule(module):
             argnames = argnames[2:]
 
             if not fwdDiffFnName == "":
-                fwdDiffFn = WrappedFunction(fwdDiffFnName, getattr(module, fwdDiffFnName), argnames, argwrappers)
+                fwdDiffFn = WrappedFunction(fwdDiffFnName, getattr(module, fwdDiffFnName), argnames, argwrappers, specializer=specializer)
             else:
                 fwdDiffFn = None
             
             if not bwdDiffFnName == "":
-                bwdDiffFn = WrappedFunction(bwdDiffFnName, getattr(module, bwdDiffFnName), argnames, argwrappers)
+                bwdDiffFn = WrappedFunction(bwdDiffFnName, getattr(module, bwdDiffFnName), argnames, argwrappers, specializer=specializer)
             else:
                 bwdDiffFn = None
             
@@ -202,7 +210,7 @@ def wrapModule(module):
             wrappedFn = WrappedFunction(
                 primalFnName,
                 getattr(module, primalFnName),
-                argnames, argwrappers, fwdDiffFn, bwdDiffFn)
+                argnames, argwrappers, fwdDiffFn, bwdDiffFn, specializer)
             
             attributes[primalFnName] = wrappedFn
             processed.add(primalFnName)
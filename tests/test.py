@@ -98,6 +98,58 @@ class TestOptions(unittest.TestCase):
             with suppressOutput():
                 module = slangtorch.loadModule(slangModuleFile, defines={})
 
+    def test_load_module_variants(self):
+        test_dir = os.path.dirname(os.path.abspath(__file__))
+        slangModuleSourceFile = os.path.join(test_dir, 'multiply.slang')
+
+        import tempfile
+        import shutil
+        import glob
+        tmpdir = tempfile.mkdtemp()
+        slangModuleFile = os.path.join(tmpdir, 'multiply.slang')
+        shutil.copy(slangModuleSourceFile, slangModuleFile)
+
+        factors = ['2.0', '1.0', '3.0', '2.0']
+        modules = slangtorch.loadModuleVariants(slangModuleFile, [{'FACTOR': factor} for factor in factors])
+        assert(len(modules) == len(factors))
+
+        X = torch.tensor([[1., 2.], [3., 4.]]).cuda()
+        for module, factor in zip(modules, factors):
+            Y = module.multiply(X).cpu()
+            assert(torch.all(torch.eq(Y, X.cpu() * float(factor))))
+
+        # All variants are built into a single binary.
+        binaries = glob.glob(os.path.join(tmpdir, '.slangtorch_cache', 'multiply', '*', '*', '*.so'))
+        assert(len(binaries) == 1)
+
+    def test_specialization_constants(self):
+        test_dir = os.path.dirname(os.path.abspath(__file__))
+        slangModuleSourceFile = os.path.join(test_dir, 'multiply.slang')
+
+        import tempfile
+        import shutil
+        import glob
+        tmpdir = tempfile.mkdtemp()
+        slangModuleFile = os.path.join(tmpdir, 'multiply.slang')
+        shutil.copy(slangModuleSourceFile, slangModuleFile)
+
+        X = torch.tensor([[1., 2.], [3., 4.]]).cuda()
+        hostObjectTimes = set()
+        for factor in ['2.0', '1.0', '2.0', '1.0']:
+            module = slangtorch.loadModule(slangModuleFile, specializationConstants={'FACTOR': factor})
+            Y = module.multiply(X).cpu()
+            assert(torch.all(torch.eq(Y, X.cpu() * float(factor))))
+
+            hostObjects = glob.glob(os.path.join(tmpdir, '.slangtorch_cache', 'multiply', '*', '*', 'multiply_slangtorch_host.o'))
+            assert(len(hostObjects) > 0)
+            hostObjectTimes.update(os.path.getmtime(hostObject) for hostObject in hostObjects)
+
+        # Changing a value rebuilds the module in the same options folder, without recompiling
+        # the host source (every build directory has the object of the first build).
+        optionsFolders = glob.glob(os.path.join(tmpdir, '.slangtorch_cache', 'multiply', '*'))
+        assert(len(optionsFolders) == 1)
+        assert(len(hostObjectTimes) == 1)
+
 class TestHotReload(unittest.TestCase):
     def test_hot_reload(self):
         test_dir = os.path.dirname(os.path.abspath(__file__))
@@ -134,6 +186,96 @@ class TestHotReload(unittest.TestCase):
         expected2 = torch.tensor([[1., 2.],[3., 4.]]).cpu()
         assert(torch.all(torch.eq(Y2, expected2)))
 
+    def test_kernel_edit_keeps_host_source(self):
+        test_dir = os.path.dirname(os.path.abspath(__file__))
+        slangModuleTemplateFile = os.path.join(test_dir, 'multiply_template.slang')
+
+        # Get a temporary directory.
+        import tempfile
+        import glob
+        tmpdir = tempfile.mkdtemp()
+
+        slangModuleFile = os.path.join(tmpdir, 'multiply.slang')
+        with open(slangModuleTemplateFile, 'r') as f:
+            template = f.read()
+
+        with open(slangModuleFile, 'w') as f:
+            f.write(template.replace(r'%FACTOR%', '2.0'))
+        slangtorch.loadModule(slangModuleFile)
+
+        hostSource = glob.glob(os.path.join(tmpdir, '.slangtorch_cache', 'multiply', '*', 'multiply.cpp'))[0]
+        hostSourceMtime = os.path.getmtime(hostSource)
+
+        # Only the kernel changes, so the generated host source is left untouched.
+        with open(slangModuleFile, 'w') as f:
+            f.write(template.replace(r'%FACTOR%', '3.0'))
+        module = slangtorch.loadModule(slangModuleFile)
+        assert(os.path.getmtime(hostSource) == hostSourceMtime)
+
+        X = torch.tensor([[1., 2.], [3., 4.]]).cuda()
+        Y = module.multiply(X).cpu()
+        expected = torch.tensor([[3., 6.],[9., 12.]]).cpu()
+        assert(torch.all(torch.eq(Y, expected)))
+
+
+    def test_watch_reload(self):
+        test_dir = os.path.dirname(os.path.abspath(__file__))
+        slangModuleTemplateFile = os.path.join(test_dir, 'multiply_template.slang')
+
+        # Get a temporary directory.
+        import tempfile
+        tmpdir = tempfile.mkdtemp()
+
+        slangModuleFile = os.path.join(tmpdir, 'multiply.slang')
+        with open(slangModuleTemplateFile, 'r') as f:
+            template = f.read()
+
+        with open(slangModuleFile, 'w') as f:
+            f.write(template.replace(r'%FACTOR%', '2.0'))
+        module = slangtorch.loadModule(slangModuleFile, watch=True)
+        try:
+            X = torch.tensor([[1., 2.], [3., 4.]]).cuda()
+            Y1 = module.multiply(X).cpu()
+            expected1 = torch.tensor([[2., 4.],[6., 8.]]).cpu()
+            assert(torch.all(torch.eq(Y1, expected1)))
+
+            # The module is rebuilt in the background, and used from the next call on.
+            with open(slangModuleFile, 'w') as f:
+                f.write(template.replace(r'%FACTOR%', '1.0'))
+            assert(module.waitForRebuild(timeout=300))
+
+            Y2 = module.multiply(X).cpu()
+            expected2 = torch.tensor([[1., 2.],[3., 4.]]).cpu()
+            assert(torch.all(torch.eq(Y2, expected2)))
+        finally:
+            module.stopWatching()
+
+    def test_watched_files(self):
+        import tempfile
+        import json
+        tmpdir = tempfile.mkdtemp()
+        includeDir = os.path.join(tmpdir, 'include')
+        buildDir = os.path.join(tmpdir, 'build')
+        systemDir = tempfile.mkdtemp()
+        for path in (includeDir, buildDir):
+            os.makedirs(path)
+
+        slangModuleFile = os.path.join(tmpdir, 'multiply.slang')
+        importedFile = os.path.join(tmpdir, 'imported.slang')
+        localHeader = os.path.join(tmpdir, 'local.h')
+        includedHeader = os.path.join(includeDir, 'included.h')
+        systemHeader = os.path.join(systemDir, 'torch.h')
+        with open(os.path.join(buildDir, 'metadata.json'), 'w') as f:
+            json.dump({
+                "cpp": {"deps": [[slangModuleFile, 0], [importedFile, 0]]},
+                "cuda": {"deps": [[slangModuleFile, 0]]},
+                "downstreamDeps": [[localHeader, 0], [includedHeader, 0], [systemHeader, 0]],
+            }, f)
+
+        # The Slang dependencies, and only the headers in the source directory and include paths.
+        watched = slangtorch.slangtorch.getWatchedFiles(slangModuleFile, buildDir, [includeDir])
+        assert(watched == set(os.path.realpath(path) for path in [slangModuleFile, importedFile, localHeader, includedHeader]))
+
 
 class TestMultiFileModule(unittest.TestCase):
     def test_multi_file_reload(self):
@@ -208,6 +350,1011 @@ class TestCacheState(unittest.TestCase):
         assert(torch.all(torch.eq(Y1, expected1)))
 
 
+class TestConcurrentSlangCompile(unittest.TestCase):
+    def test_failing_pass_is_reported(self):
+        test_dir = os.path.dirname(os.path.abspath(__file__))
+
+        import tempfile
+        import shutil
+        import io
+        import contextlib
+        tmpdir = tempfile.mkdtemp()
+        slangModuleFile = os.path.join(tmpdir, 'multiply.slang')
+        shutil.copy(os.path.join(test_dir, 'multiply.slang'), slangModuleFile)
+
+        cppOutName = os.path.join(tmpdir, 'multiply.cpp')
+        cudaOutName = os.path.join(tmpdir, 'multiply_cuda.cu')
+        targets = [("cpp", "torch-binding", cppOutName), ("cuda", "cuda", cudaOutName)]
+        options = ['-DFACTOR=2.0']
+
+        # slangc that fails the torch-binding pass, and runs the CUDA pass normally.
+        compiler = slangtorch.slangtorch
+        realSlangcPath = compiler.slangcPath
+        failingSlangcPath = os.path.join(tmpdir, 'slangc-failing-binding.py')
+        with open(failingSlangcPath, 'w') as f:
+            f.write(f"#!{sys.executable}\n"
+                    "import os, sys\n"
+                    "if 'torch-binding' in sys.argv:\n"
+                    "    print('error: injected torch-binding failure', file=sys.stderr)\n"
+                    "    sys.exit(3)\n"
+                    f"os.execv({realSlangcPath!r}, [{realSlangcPath!r}] + sys.argv[1:])\n")
+        os.chmod(failingSlangcPath, 0o755)
+
+        # Both passes run concurrently, so the backend must be slangc.
+        oldBackend = compiler.slangCompileBackend
+        compiler.slangCompileBackend = 'slangc'
+        compiler.slangcPath = failingSlangcPath
+        try:
+            stderr = io.StringIO()
+            with self.assertRaises(RuntimeError) as context:
+                with contextlib.redirect_stderr(stderr):
+                    compiler.compileSlangTargets(None, slangModuleFile, targets, options)
+        finally:
+            compiler.slangcPath = realSlangcPath
+            compiler.slangCompileBackend = oldBackend
+
+        # The failure of the binding pass is reported, with its diagnostics.
+        assert('3' in str(context.exception))
+        assert('injected torch-binding failure' in stderr.getvalue())
+
+        # The CUDA pass succeeded, but neither output nor any temporary or dependency file is left.
+        assert(sorted(os.listdir(tmpdir)) == sorted(['multiply.slang', 'slangc-failing-binding.py']))
+
+        # Both passes succeed with the real compiler, and write complete outputs.
+        anyRecompiled, metadata = compiler.compileSlangTargets(None, slangModuleFile, targets, options)
+        assert(anyRecompiled)
+        assert(metadata["cpp"] is not None and metadata["cuda"] is not None)
+        assert(os.path.getsize(cppOutName) > 0 and os.path.getsize(cudaOutName) > 0)
+        assert(sorted(os.listdir(tmpdir)) == sorted(['multiply.slang', 'slangc-failing-binding.py',
+                                                     'multiply.cpp', 'multiply_cuda.cu']))
+
+
+class TestInProcessSlangCompile(unittest.TestCase):
+    def compileWithBackend(self, backend, slangModuleFile, outputDir, options):
+        # Returns (outputs, error message, diagnostics)
+        import io
+        import contextlib
+        compiler = slangtorch.slangtorch
+        targets = [("cpp", "torch-binding", os.path.join(outputDir, 'multiply.cpp')),
+                   ("cuda", "cuda", os.path.join(outputDir, 'multiply_cuda.cu'))]
+
+        oldBackend = compiler.slangCompileBackend
+        compiler.slangCompileBackend = backend
+        stderr = io.StringIO()
+        error = None
+        try:
+            with contextlib.redirect_stderr(stderr):
+                compiler.compileSlangTargets(None, slangModuleFile, targets, options)
+        except RuntimeError as e:
+            error = str(e)
+        finally:
+            compiler.slangCompileBackend = oldBackend
+
+        outputs = {}
+        for key, _, outputFile in targets:
+            if os.path.exists(outputFile):
+                with open(outputFile, 'r') as f:
+                    outputs[key] = f.read()
+        return outputs, error, stderr.getvalue()
+
+    def test_library_matches_slangc(self):
+        if slangtorch.slangtorch.getSlangLibraryCompiler() is None:
+            self.skipTest("the Slang library can't be loaded")
+
+        test_dir = os.path.dirname(os.path.abspath(__file__))
+        slangModuleFile = os.path.join(test_dir, 'multiply.slang')
+
+        import tempfile
+        slangcDir = tempfile.mkdtemp()
+        libraryDir = tempfile.mkdtemp()
+
+        # Same outputs for a valid module.
+        slangcOutputs, slangcError, _ = self.compileWithBackend('slangc', slangModuleFile, slangcDir, ['-DFACTOR=2.0'])
+        libraryOutputs, libraryError, _ = self.compileWithBackend('library', slangModuleFile, libraryDir, ['-DFACTOR=2.0'])
+        assert(slangcError is None and libraryError is None)
+        assert(set(slangcOutputs.keys()) == {"cpp", "cuda"})
+        assert(libraryOutputs == slangcOutputs)
+
+        # Same failure for an invalid module (FACTOR is not defined), and no outputs.
+        slangcDir = tempfile.mkdtemp()
+        libraryDir = tempfile.mkdtemp()
+        slangcOutputs, slangcError, slangcDiagnostics = self.compileWithBackend('slangc', slangModuleFile, slangcDir, [])
+        libraryOutputs, libraryError, libraryDiagnostics = self.compileWithBackend('library', slangModuleFile, libraryDir, [])
+        assert(slangcError is not None and libraryError is not None)
+        assert(slangcOutputs == {} and libraryOutputs == {})
+        assert('FACTOR' in slangcDiagnostics and 'FACTOR' in libraryDiagnostics)
+
+    def test_fallback_to_slangc(self):
+        test_dir = os.path.dirname(os.path.abspath(__file__))
+        slangModuleFile = os.path.join(test_dir, 'multiply.slang')
+
+        import tempfile
+        compiler = slangtorch.slangtorch
+        slangcOutputs, _, _ = self.compileWithBackend('slangc', slangModuleFile, tempfile.mkdtemp(), ['-DFACTOR=2.0'])
+
+        # Pretend that the library is not loaded yet, and is not a loadable binary.
+        brokenLibraryPath = os.path.join(tempfile.mkdtemp(), 'libslang.so')
+        with open(brokenLibraryPath, 'w') as f:
+            f.write("not a shared library")
+
+        oldState = (compiler._slangLibraryCompiler, compiler._slangLibraryCompilerFailed,
+                    compiler.getSlangDynamicLibraryPathCached)
+        compiler._slangLibraryCompiler = None
+        compiler._slangLibraryCompilerFailed = False
+        compiler.getSlangDynamicLibraryPathCached = lambda: brokenLibraryPath
+        try:
+            outputs, error, diagnostics = self.compileWithBackend('library', slangModuleFile, tempfile.mkdtemp(), ['-DFACTOR=2.0'])
+            assert(compiler._slangLibraryCompiler is None and compiler._slangLibraryCompilerFailed)
+        finally:
+            (compiler._slangLibraryCompiler, compiler._slangLibraryCompilerFailed,
+             compiler.getSlangDynamicLibraryPathCached) = oldState
+
+        # The module is compiled by slangc instead, with a warning.
+        assert(error is None)
+        assert('Falling back to slangc' in diagnostics)
+        assert(outputs == slangcOutputs)
+
+
+class TestWarmCache(unittest.TestCase):
+    def test_warm_load_is_cache_hit(self):
+        test_dir = os.path.dirname(os.path.abspath(__file__))
+        slangModuleSourceFile = os.path.join(test_dir, 'multiply.slang')
+
+        # Get a temporary directory.
+        import tempfile
+        import shutil
+        tmpdir = tempfile.mkdtemp()
+
+        slangModuleFile = os.path.join(tmpdir, 'multiply.slang')
+        shutil.copy(slangModuleSourceFile, slangModuleFile)
+
+        # Cold load, builds the module.
+        slangtorch.loadModule(slangModuleFile, defines={'FACTOR': '2.0'})
+
+        import glob
+        metadataFiles = glob.glob(os.path.join(tmpdir, '.slangtorch_cache', '**', 'metadata.json'), recursive=True)
+        assert(len(metadataFiles) == 1)
+        metadataMtime = os.path.getmtime(metadataFiles[0])
+
+        # Warm load, should be served from the existing build without touching the metadata.
+        slangtorch.clearSessionShaderCache()
+        hits = slangtorch.getCacheStats()["hits"]
+        module = slangtorch.loadModule(slangModuleFile, defines={'FACTOR': '2.0'})
+
+        assert(slangtorch.getCacheStats()["hits"] == hits + 1)
+        assert(os.path.getmtime(metadataFiles[0]) == metadataMtime)
+
+        X = torch.tensor([[1., 2.], [3., 4.]]).cuda()
+        Y = module.multiply(X).cpu()
+        expected = torch.tensor([[2., 4.],[6., 8.]]).cpu()
+        assert(torch.all(torch.eq(Y, expected)))
+
+    def test_touched_source_is_cache_hit_with_content_hash(self):
+        test_dir = os.path.dirname(os.path.abspath(__file__))
+        slangModuleSourceFile = os.path.join(test_dir, 'multiply.slang')
+
+        # Get a temporary directory.
+        import tempfile
+        import shutil
+        tmpdir = tempfile.mkdtemp()
+
+        slangModuleFile = os.path.join(tmpdir, 'multiply.slang')
+        shutil.copy(slangModuleSourceFile, slangModuleFile)
+
+        slangtorch.loadModule(slangModuleFile, defines={'FACTOR': '2.0'}, contentHashDeps=True)
+
+        # Touch the source without changing its contents.
+        import time
+        newTime = time.time() + 10
+        os.utime(slangModuleFile, (newTime, newTime))
+
+        slangtorch.clearSessionShaderCache()
+        hits = slangtorch.getCacheStats()["hits"]
+        slangtorch.loadModule(slangModuleFile, defines={'FACTOR': '2.0'}, contentHashDeps=True)
+
+        assert(slangtorch.getCacheStats()["hits"] == hits + 1)
+
+    def test_cache_hit_without_module_lock(self):
+        test_dir = os.path.dirname(os.path.abspath(__file__))
+        slangModuleSourceFile = os.path.join(test_dir, 'multiply.slang')
+
+        # Get a temporary directory.
+        import tempfile
+        import shutil
+        import glob
+        import subprocess
+        tmpdir = tempfile.mkdtemp()
+
+        slangModuleFile = os.path.join(tmpdir, 'multiply.slang')
+        shutil.copy(slangModuleSourceFile, slangModuleFile)
+
+        slangtorch.loadModule(slangModuleFile, defines={'FACTOR': '2.0'})
+
+        # Another process holds the module lock (as if it was building).
+        lockFiles = glob.glob(os.path.join(tmpdir, 'multiply.slang*.lock'))
+        assert(len(lockFiles) == 1)
+        holder = subprocess.Popen(
+            [sys.executable, '-c', 'import sys, time; from filelock import FileLock; '
+             'lock = FileLock(sys.argv[1]); lock.acquire(); print("locked", flush=True); time.sleep(600)', lockFiles[0]],
+            stdout=subprocess.PIPE)
+        try:
+            assert(holder.stdout.readline().strip() == b"locked")
+
+            # A warm load doesn't wait for the lock.
+            slangtorch.clearSessionShaderCache()
+            hits = slangtorch.getCacheStats()["hits"]
+            module = slangtorch.loadModule(slangModuleFile, defines={'FACTOR': '2.0'})
+            assert(slangtorch.getCacheStats()["hits"] == hits + 1)
+        finally:
+            holder.kill()
+            holder.wait()
+
+        X = torch.tensor([[1., 2.], [3., 4.]]).cuda()
+        Y = module.multiply(X).cpu()
+        expected = torch.tensor([[2., 4.],[6., 8.]]).cpu()
+        assert(torch.all(torch.eq(Y, expected)))
+
+
+class TestGlobalBuildCache(unittest.TestCase):
+    def makeModule(self, sourceDir, name, contents):
+        # Returns (key, sources, moduleBinary) of a fake built module in sourceDir.
+        from slangtorch.util import GlobalBuildCache
+        os.makedirs(sourceDir, exist_ok=True)
+        source = os.path.join(sourceDir, f'{name}.cpp')
+        with open(source, 'w') as f:
+            f.write(f'// {sourceDir}\n{contents}\n')
+        moduleBinary = os.path.join(sourceDir, f'{name}.so')
+        with open(moduleBinary, 'wb') as f:
+            f.write(b'\0' * 1000)
+        key = GlobalBuildCache.makeKey([source], ['-O3'], {'cxx': 'test'}, sourceDir)
+        return key, [source], moduleBinary
+
+    def test_hit_and_miss(self):
+        import tempfile
+        import shutil
+        from slangtorch.util import GlobalBuildCache
+        tmpdir = tempfile.mkdtemp()
+        cache = GlobalBuildCache(os.path.join(tmpdir, 'cache'), None)
+
+        sourceDir = os.path.join(tmpdir, 'a')
+        key, _, moduleBinary = self.makeModule(sourceDir, 'multiply', 'int x;')
+        header = os.path.join(sourceDir, 'header.h')
+        with open(header, 'w') as f:
+            f.write('#define FACTOR 2\n')
+
+        # Miss on an empty cache, hit after an insert.
+        assert(cache.lookup(key, sourceDir) is None)
+        cache.insert(key, 'multiply_abc', moduleBinary, [header], sourceDir)
+        moduleName, cachedBinary, headerDeps = cache.lookup(key, sourceDir)
+        assert(moduleName == 'multiply_abc')
+        assert(headerDeps == [header])
+        with open(cachedBinary, 'rb') as f:
+            assert(f.read() == b'\0' * 1000)
+
+        # Identical module in another directory (the directory is left out of the key): hit,
+        # with the header dependency resolved in that directory.
+        otherDir = os.path.join(tmpdir, 'b')
+        otherKey, _, _ = self.makeModule(otherDir, 'multiply', 'int x;')
+        shutil.copy2(header, os.path.join(otherDir, 'header.h'))
+        assert(otherKey == key)
+        assert(cache.lookup(key, otherDir)[2] == [os.path.join(otherDir, 'header.h')])
+
+        # Different sources or flags: miss.
+        changedKey, _, _ = self.makeModule(os.path.join(tmpdir, 'c'), 'multiply', 'int y;')
+        assert(changedKey != key and cache.lookup(changedKey, sourceDir) is None)
+        assert(GlobalBuildCache.makeKey([os.path.join(sourceDir, 'multiply.cpp')], ['-O0'], {'cxx': 'test'}, sourceDir) != key)
+
+        # Changed or missing header: miss.
+        with open(header, 'w') as f:
+            f.write('#define FACTOR 3\n')
+        assert(cache.lookup(key, sourceDir) is None)
+        os.remove(header)
+        assert(cache.lookup(key, sourceDir) is None)
+
+    def test_lru_eviction(self):
+        import tempfile
+        from slangtorch.util import GlobalBuildCache
+        tmpdir = tempfile.mkdtemp()
+        cacheDir = os.path.join(tmpdir, 'cache')
+
+        # Room for two entries. The writer never loads entries, a separate cache object stands in
+        # for the process that uses them.
+        writer = GlobalBuildCache(cacheDir, 2500)
+        reader = GlobalBuildCache(cacheDir, 2500)
+
+        modules = {}
+        for index, name in enumerate(['a', 'b']):
+            sourceDir = os.path.join(tmpdir, name)
+            modules[name] = self.makeModule(sourceDir, name, name)
+            key, _, moduleBinary = modules[name]
+            writer.insert(key, name, moduleBinary, [], sourceDir)
+
+            # Distinct, old last-use times.
+            entryFile = os.path.join(writer._entryDir(key), 'entry.json')
+            os.utime(entryFile, (1000 + index, 1000 + index))
+
+        # 'a' is used, so 'b' is now the least recently used entry, and is evicted for 'c'.
+        assert(reader.lookup(modules['a'][0], os.path.join(tmpdir, 'a')) is not None)
+        sourceDir = os.path.join(tmpdir, 'c')
+        modules['c'] = self.makeModule(sourceDir, 'c', 'c')
+        writer.insert(modules['c'][0], 'c', modules['c'][2], [], sourceDir)
+
+        assert(reader.lookup(modules['a'][0], os.path.join(tmpdir, 'a')) is not None)
+        assert(reader.lookup(modules['b'][0], os.path.join(tmpdir, 'b')) is None)
+        assert(reader.lookup(modules['c'][0], os.path.join(tmpdir, 'c')) is not None)
+
+        # Entries in use by a process are not evicted by that process, even when over budget.
+        reader.maxSizeBytes = 0
+        reader.evict()
+        assert(reader.lookup(modules['a'][0], os.path.join(tmpdir, 'a')) is not None)
+        assert(reader.lookup(modules['c'][0], os.path.join(tmpdir, 'c')) is not None)
+
+    def test_cache_hit_loads_a_copy(self):
+        test_dir = os.path.dirname(os.path.abspath(__file__))
+
+        import tempfile
+        import shutil
+        globalCacheDir = tempfile.mkdtemp()
+        modules = []
+        binaries = []
+        for _ in range(2):
+            tmpdir = tempfile.mkdtemp()
+            slangModuleFile = os.path.join(tmpdir, 'multiply.slang')
+            shutil.copy(os.path.join(test_dir, 'multiply.slang'), slangModuleFile)
+            modules.append(slangtorch.loadModule(slangModuleFile, defines={'FACTOR': '2.0'}, globalCacheDir=globalCacheDir))
+            binaries.append([os.stat(os.path.join(dirPath, f)) for dirPath, _, files in os.walk(tmpdir)
+                             for f in files if f.startswith('_slangtorch_multiply') and f.endswith('.so')])
+
+        # The second module comes from the cache, as a separate file rather than a hardlink of
+        # the cache entry or of the first module's binary.
+        assert(len(binaries[1]) == 1)
+        assert(binaries[1][0].st_nlink == 1)
+        assert(all((b.st_dev, b.st_ino) != (binaries[1][0].st_dev, binaries[1][0].st_ino) for b in binaries[0]))
+
+        X = torch.tensor([[1., 2.], [3., 4.]]).cuda()
+        for module in modules:
+            Y = module.multiply(X).cpu()
+            assert(torch.all(torch.eq(Y, torch.tensor([[2., 4.],[6., 8.]]))))
+
+
+class TestJobBudget(unittest.TestCase):
+    def test_memory_cap(self):
+        from slangtorch.util.jobs import JobBudget
+
+        # 4096 MB fits four jobs of 1024 MB, out of eight CPUs.
+        budget = JobBudget(8, maxMemoryMB=4096, jobMemoryMB=1024)
+        assert(budget.maxJobs == 4)
+        assert(budget.acquire(10) == 4)
+        budget.release(4)
+
+        # At least one job, even if it doesn't fit. No cap without a memory limit.
+        assert(JobBudget(8, maxMemoryMB=512, jobMemoryMB=1024).maxJobs == 1)
+        assert(JobBudget(8, maxMemoryMB=None, jobMemoryMB=1024).maxJobs == 8)
+
+        # Jobs over the cap wait for a slot.
+        import threading
+        budget = JobBudget(8, maxMemoryMB=2048, jobMemoryMB=1024)
+        assert(budget.acquire(2) == 2)
+        granted = []
+        waiter = threading.Thread(target=lambda: granted.append(budget.acquire(1)))
+        waiter.start()
+        waiter.join(0.2)
+        assert(granted == [])
+        budget.release(2)
+        waiter.join()
+        assert(granted == [1])
+
+    def test_memory_cap_from_environment(self):
+        from slangtorch.util import jobs
+        settings = {'MAX_JOBS': '8', 'SLANGTORCH_BUILD_MEMORY_MB': '3000', 'SLANGTORCH_JOB_MEMORY_MB': '1000'}
+        oldSettings = {name: os.environ.get(name) for name in settings}
+        oldBudget = jobs._jobBudget
+        try:
+            os.environ.update(settings)
+            jobs._jobBudget = None
+            assert(jobs.getJobBudget().maxJobs == 3)
+        finally:
+            jobs._jobBudget = oldBudget
+            for name, value in oldSettings.items():
+                if value is None:
+                    os.environ.pop(name, None)
+                else:
+                    os.environ[name] = value
+
+    def test_available_memory(self):
+        import tempfile
+        from slangtorch.util import jobs
+        meminfoFile = os.path.join(tempfile.mkdtemp(), 'meminfo')
+        with open(meminfoFile, 'w') as f:
+            f.write("MemTotal:       16384000 kB\n"
+                    "MemFree:          512000 kB\n"
+                    "MemAvailable:    8192000 kB\n"
+                    "Cached:          7000000 kB\n")
+
+        # Available memory includes the reclaimable page cache, not just free memory.
+        assert(jobs._getAvailableMemoryMB(meminfoFile) == 8000)
+        assert(jobs._getAvailableMemoryMB(os.path.join(os.path.dirname(meminfoFile), 'missing')) is None)
+
+
+class TestToolchainCache(unittest.TestCase):
+    def test_toolchain_cache_file(self):
+        import tempfile
+        import json
+        compiler = slangtorch.slangtorch
+        tmpdir = tempfile.mkdtemp()
+
+        # The cache lives outside of the package.
+        assert(os.path.commonpath([os.path.realpath(compiler.TOOLCHAIN_CACHE_FILE), os.path.realpath(compiler.packageDir)])
+               != os.path.realpath(compiler.packageDir))
+
+        toolFile = os.path.join(tmpdir, 'tool')
+        with open(toolFile, 'w') as f:
+            f.write('version 1')
+
+        computeCount = [0]
+        def compute():
+            computeCount[0] += 1
+            return f"value {computeCount[0]}"
+
+        def getValue(validateFn=None):
+            # A fresh process only has the file.
+            compiler._toolchainInfo.pop('test', None)
+            return compiler.getCachedToolchainValue('test', lambda: compiler.getFileIdentity(toolFile), compute, validateFn)
+
+        oldCacheFile = compiler.TOOLCHAIN_CACHE_FILE
+        compiler.TOOLCHAIN_CACHE_FILE = os.path.join(tmpdir, 'cache', 'toolchain.json')
+        try:
+            # Computed once, then read from the file.
+            assert(getValue() == "value 1")
+            with open(compiler.TOOLCHAIN_CACHE_FILE, 'r') as f:
+                assert(json.load(f)['test']['value'] == "value 1")
+            assert(getValue() == "value 1")
+            assert(computeCount[0] == 1)
+
+            # Recomputed when the tool changes.
+            with open(toolFile, 'w') as f:
+                f.write('version 2, larger')
+            assert(getValue() == "value 2")
+            assert(getValue() == "value 2")
+
+            # Recomputed when the cached value is no longer valid.
+            assert(getValue(lambda value: value != "value 2") == "value 3")
+            assert(computeCount[0] == 3)
+
+            # A corrupt file is ignored.
+            with open(compiler.TOOLCHAIN_CACHE_FILE, 'w') as f:
+                f.write('{')
+            assert(getValue() == "value 4")
+        finally:
+            compiler._toolchainInfo.pop('test', None)
+            compiler.TOOLCHAIN_CACHE_FILE = oldCacheFile
+
+
+class TestCloneBuildDir(unittest.TestCase):
+    # Build outputs that are only replaced, and files that a rebuild writes in place.
+    IMMUTABLE_FILES = ['multiply.o', 'multiply_cuda.cuda.o', '_slangtorch_multiply.so']
+    MUTABLE_FILES = ['build.ninja', '.ninja_log', '.ninja_deps', 'multiply.cpp', 'multiply_cuda.cu', 'metadata.json']
+
+    def makeBuildDir(self):
+        import tempfile
+        tmpdir = tempfile.mkdtemp()
+        srcDir = os.path.join(tmpdir, 'src')
+        os.makedirs(os.path.join(srcDir, 'sub'))
+        for index, fileName in enumerate(self.IMMUTABLE_FILES + self.MUTABLE_FILES + ['lock', '.inuse.lock', 'sub/multiply.o']):
+            filePath = os.path.join(srcDir, fileName)
+            with open(filePath, 'w') as f:
+                f.write(fileName)
+            os.utime(filePath, (1000000 + index, 1000000 + index))
+        return srcDir, os.path.join(tmpdir, 'dst')
+
+    def checkClone(self, srcDir, dstDir):
+        # Same files, contents and mtimes, without the locks.
+        assert(not os.path.exists(os.path.join(dstDir, 'lock')))
+        assert(not os.path.exists(os.path.join(dstDir, '.inuse.lock')))
+        for fileName in self.IMMUTABLE_FILES + self.MUTABLE_FILES + ['sub/multiply.o']:
+            srcFile = os.path.join(srcDir, fileName)
+            dstFile = os.path.join(dstDir, fileName)
+            with open(dstFile, 'r') as f:
+                assert(f.read() == fileName)
+            assert(os.path.getmtime(dstFile) == os.path.getmtime(srcFile))
+
+    def isHardlink(self, srcDir, dstDir, fileName):
+        return os.path.samefile(os.path.join(srcDir, fileName), os.path.join(dstDir, fileName))
+
+    def test_reflink(self):
+        from unittest import mock
+        from slangtorch.util import clone
+
+        def fakeReflink(srcFile, dstFile):
+            import shutil
+            shutil.copy2(srcFile, dstFile)
+            return True
+
+        srcDir, dstDir = self.makeBuildDir()
+        with mock.patch.object(clone, 'fcntl', object()), mock.patch.object(clone, '_tryReflink', fakeReflink), \
+             mock.patch.object(clone.sys, 'platform', 'linux'):
+            stats = clone.cloneBuildDir(srcDir, dstDir)
+
+        self.checkClone(srcDir, dstDir)
+        assert(stats == {"reflinked": len(self.IMMUTABLE_FILES + self.MUTABLE_FILES) + 1, "hardlinked": 0, "copied": 0})
+
+    def test_hardlink_without_reflink(self):
+        from unittest import mock
+        from slangtorch.util import clone
+        if sys.platform == "win32":
+            self.skipTest("build outputs are not hardlinked on Windows")
+
+        def failingReflink(srcFile, dstFile):
+            return False
+
+        srcDir, dstDir = self.makeBuildDir()
+        with mock.patch.object(clone, '_tryReflink', failingReflink):
+            stats = clone.cloneBuildDir(srcDir, dstDir)
+
+        self.checkClone(srcDir, dstDir)
+        assert(stats == {"reflinked": 0, "hardlinked": len(self.IMMUTABLE_FILES) + 1, "copied": len(self.MUTABLE_FILES)})
+
+        # Only the outputs that a rebuild replaces are shared with the source directory.
+        for fileName in self.IMMUTABLE_FILES + ['sub/multiply.o']:
+            assert(self.isHardlink(srcDir, dstDir, fileName))
+        for fileName in self.MUTABLE_FILES:
+            assert(not self.isHardlink(srcDir, dstDir, fileName))
+            assert(not fileName.endswith(clone.IMMUTABLE_EXTENSIONS))
+
+    def test_copy_without_links(self):
+        import errno
+        from unittest import mock
+        from slangtorch.util import clone
+
+        def failingReflink(srcFile, dstFile):
+            return False
+
+        def failingLink(srcFile, dstFile):
+            raise OSError(errno.EXDEV, "Invalid cross-device link")
+
+        srcDir, dstDir = self.makeBuildDir()
+        with mock.patch.object(clone, '_tryReflink', failingReflink), mock.patch.object(clone.os, 'link', failingLink):
+            stats = clone.cloneBuildDir(srcDir, dstDir)
+
+        self.checkClone(srcDir, dstDir)
+        assert(stats == {"reflinked": 0, "hardlinked": 0, "copied": len(self.IMMUTABLE_FILES + self.MUTABLE_FILES) + 1})
+        for fileName in self.IMMUTABLE_FILES + self.MUTABLE_FILES:
+            assert(not self.isHardlink(srcDir, dstDir, fileName))
+
+
+class TestBuildDirCollection(unittest.TestCase):
+    def test_stale_build_dirs_are_removed(self):
+        test_dir = os.path.dirname(os.path.abspath(__file__))
+        slangModuleSourceFile = os.path.join(test_dir, 'multiply.slang')
+
+        # Get a temporary directory.
+        import tempfile
+        import shutil
+        tmpdir = tempfile.mkdtemp()
+
+        slangModuleFile = os.path.join(tmpdir, 'multiply.slang')
+        shutil.copy(slangModuleSourceFile, slangModuleFile)
+
+        module = slangtorch.loadModule(slangModuleFile, defines={'FACTOR': '2.0'})
+
+        import glob
+        latestFiles = glob.glob(os.path.join(tmpdir, '.slangtorch_cache', '**', 'latest.txt'), recursive=True)
+        assert(len(latestFiles) == 1)
+        outputFolder = os.path.dirname(latestFiles[0])
+        with open(latestFiles[0], 'r') as f:
+            latestDir = os.path.join(outputFolder, f.read())
+
+        # Simulate old builds left behind by earlier sessions.
+        staleDirs = []
+        for buildID in range(100, 104):
+            staleDir = os.path.join(outputFolder, str(buildID))
+            shutil.copytree(latestDir, staleDir)
+            os.utime(os.path.join(staleDir, 'metadata.json'), (buildID, buildID))
+            staleDirs.append(staleDir)
+
+        removed = slangtorch.collectStaleBuildDirs(slangModuleFile, keep=2)
+
+        # The most recent stale build is kept along with the latest (loaded) one.
+        assert(sorted(removed) == sorted(staleDirs[:-1]))
+        assert(os.path.exists(staleDirs[-1]))
+        assert(os.path.exists(latestDir))
+
+        X = torch.tensor([[1., 2.], [3., 4.]]).cuda()
+        Y = module.multiply(X).cpu()
+        expected = torch.tensor([[2., 4.],[6., 8.]]).cpu()
+        assert(torch.all(torch.eq(Y, expected)))
+
+
+class TestPrecompiledPrelude(unittest.TestCase):
+    @unittest.skipIf(sys.platform == "win32", "Precompiled preludes are not supported with MSVC")
+    def test_modules_share_precompiled_prelude(self):
+        test_dir = os.path.dirname(os.path.abspath(__file__))
+
+        # Get a temporary directory.
+        import tempfile
+        import shutil
+        tmpdir = tempfile.mkdtemp()
+
+        for name in ['multiply.slang', 'copy.slang']:
+            shutil.copy(os.path.join(test_dir, name), os.path.join(tmpdir, name))
+
+        module = slangtorch.loadModule(os.path.join(tmpdir, 'multiply.slang'), defines={'FACTOR': '2.0'})
+        slangtorch.loadModule(os.path.join(tmpdir, 'copy.slang'))
+
+        # Both modules have the same prelude, and use the same precompiled header.
+        import glob
+        pchFiles = glob.glob(os.path.join(tmpdir, '.slangtorch_cache', '.pch', '*', 'prelude.h.gch'))
+        assert(len(pchFiles) == 1)
+
+        X = torch.tensor([[1., 2.], [3., 4.]]).cuda()
+        Y = module.multiply(X).cpu()
+        expected = torch.tensor([[2., 4.],[6., 8.]]).cpu()
+        assert(torch.all(torch.eq(Y, expected)))
+
+    @unittest.skipIf(sys.platform == "win32", "Precompiled preludes are not supported with MSVC")
+    def test_precompiled_prelude_uses_module_flags(self):
+        import tempfile
+        import shutil
+        import glob
+        from slangtorch.util import getPrecompiledPreludeSources
+        from slangtorch.util.pch import PRELUDE_END_MARKER, isGccCompiler
+        from slangtorch.util.compile import get_host_compile_flags
+        if shutil.which('ninja') is None:
+            self.skipTest("ninja is not available")
+        tmpdir = tempfile.mkdtemp()
+
+        # The prelude only compiles with the define the module is compiled with.
+        hostSource = os.path.join(tmpdir, 'module.cpp')
+        with open(hostSource, 'w') as f:
+            f.write("#ifndef PRELUDE_VALUE\n"
+                    "#error PRELUDE_VALUE is not defined\n"
+                    "#endif\n"
+                    "static const int kPreludeValue = PRELUDE_VALUE;\n"
+                    f"{PRELUDE_END_MARKER}\n"
+                    "int moduleValue() { return kPreludeValue; }\n")
+
+        pchRoot = os.path.join(tmpdir, '.pch')
+        for value in ['2', '3']:
+            cflags = [f'-DPRELUDE_VALUE={value}']
+            if not isGccCompiler(get_host_compile_flags(tmpdir, cflags, [tmpdir])['cxx']):
+                self.skipTest("the host compiler is not GCC")
+            sources, pchCflags, _ = getPrecompiledPreludeSources([hostSource], pchRoot, cflags, [tmpdir], 'toolchain')
+            assert(sources != [hostSource])
+            assert(pchCflags == ['-Winvalid-pch'])
+
+        # Each value of the define has its own precompiled header.
+        assert(len(glob.glob(os.path.join(pchRoot, '*', 'prelude.h.gch'))) == 2)
+
+    @unittest.skipIf(not sys.platform.startswith("linux"), "The shared prelude library is only supported on Linux")
+    def test_shared_prelude_library(self):
+        test_dir = os.path.dirname(os.path.abspath(__file__))
+
+        # Get a temporary directory.
+        import tempfile
+        import shutil
+        tmpdir = tempfile.mkdtemp()
+
+        slangModuleFile = os.path.join(tmpdir, 'multiply.slang')
+        shutil.copy(os.path.join(test_dir, 'multiply.slang'), slangModuleFile)
+
+        os.environ['SLANGTORCH_SHARED_PRELUDE'] = '1'
+        try:
+            module = slangtorch.loadModule(slangModuleFile, defines={'FACTOR': '2.0'})
+        finally:
+            del os.environ['SLANGTORCH_SHARED_PRELUDE']
+
+        import glob
+        libraries = glob.glob(os.path.join(tmpdir, '.slangtorch_cache', '.pch', '*', 'libslangtorch_prelude_*.so'))
+        assert(len(libraries) == 1)
+
+        # The module loads the library from its own directory, not from the precompiled prelude's.
+        moduleBinaries = glob.glob(os.path.join(tmpdir, '.slangtorch_cache', 'multiply', '*', '*', '_slangtorch_multiply_*.so'))
+        assert(len(moduleBinaries) >= 1)
+        for moduleBinary in moduleBinaries:
+            assert(os.path.exists(os.path.join(os.path.dirname(moduleBinary), os.path.basename(libraries[0]))))
+            with open(moduleBinary, 'rb') as f:
+                assert(b'.slangtorch_cache/.pch' not in f.read())
+
+        X = torch.tensor([[1., 2.], [3., 4.]]).cuda()
+        Y = module.multiply(X).cpu()
+        expected = torch.tensor([[2., 4.],[6., 8.]]).cpu()
+        assert(torch.all(torch.eq(Y, expected)))
+
+
+class TestPrebuiltModules(unittest.TestCase):
+    def test_build_and_load_prebuilt_module(self):
+        test_dir = os.path.dirname(os.path.abspath(__file__))
+
+        # Get a temporary directory.
+        import tempfile
+        import shutil
+        tmpdir = tempfile.mkdtemp()
+
+        slangModuleFile = os.path.join(tmpdir, 'multiply.slang')
+        shutil.copy(os.path.join(test_dir, 'multiply.slang'), slangModuleFile)
+
+        prebuiltDir = os.path.join(tmpdir, 'prebuilt')
+        from slangtorch.__main__ import main
+        assert(main(['build', slangModuleFile, '-D', 'FACTOR=2.0', '-o', prebuiltDir]) == 0)
+
+        # The package is relocatable.
+        movedDir = os.path.join(tempfile.mkdtemp(), 'kernels')
+        shutil.move(prebuiltDir, movedDir)
+
+        module = slangtorch.loadPrebuiltModule(movedDir, 'multiply', defines={'FACTOR': '2.0'})
+
+        X = torch.tensor([[1., 2.], [3., 4.]]).cuda()
+        Y = module.multiply(X).cpu()
+        expected = torch.tensor([[2., 4.],[6., 8.]]).cpu()
+        assert(torch.all(torch.eq(Y, expected)))
+
+
+class TestWarmup(unittest.TestCase):
+    def test_warmup_manifest(self):
+        test_dir = os.path.dirname(os.path.abspath(__file__))
+
+        # Get a temporary directory.
+        import tempfile
+        import shutil
+        import json
+        tmpdir = tempfile.mkdtemp()
+        shutil.copy(os.path.join(test_dir, 'multiply.slang'), tmpdir)
+
+        manifestFile = os.path.join(tmpdir, 'warmup.json')
+        with open(manifestFile, 'w') as f:
+            json.dump({"version": 1, "modules": [
+                {"fileName": os.path.join(tmpdir, 'multiply.slang'), "defines": {"FACTOR": "2.0"}},
+                {"fileName": os.path.join(tmpdir, 'multiply.slang'), "defines": {"FACTOR": "3.0"}}]}, f)
+
+        # A relative file name is resolved against the directory of the manifest, without
+        # changing the working directory of the process.
+        with open(manifestFile, 'r') as f:
+            manifest = json.load(f)
+        manifest["modules"].append({"fileName": "multiply.slang", "defines": {"FACTOR": "4.0"}})
+        with open(manifestFile, 'w') as f:
+            json.dump(manifest, f)
+
+        from slangtorch.__main__ import main
+        cwd = os.getcwd()
+        assert(main(['warmup', manifestFile]) == 0)
+        assert(os.getcwd() == cwd)
+
+        # All variants are served from the cache.
+        slangtorch.clearSessionShaderCache()
+        hits = slangtorch.getCacheStats()["hits"]
+        for factor in ("2.0", "3.0", "4.0"):
+            slangtorch.loadModule(os.path.join(tmpdir, 'multiply.slang'), defines={"FACTOR": factor})
+        assert(slangtorch.getCacheStats()["hits"] == hits + 3)
+
+        # A module that doesn't compile fails the warm-up.
+        with open(os.path.join(tmpdir, 'broken.slang'), 'w') as f:
+            f.write("this is not slang")
+        with open(manifestFile, 'w') as f:
+            json.dump({"version": 1, "modules": [{"fileName": "broken.slang"}]}, f)
+        assert(main(['warmup', manifestFile]) != 0)
+
+
+    def test_record_manifest(self):
+        import tempfile
+        import json
+        compiler = slangtorch.slangtorch
+        tmpdir = tempfile.mkdtemp()
+        manifestFile = os.path.join(tmpdir, 'recorded.json')
+
+        os.environ['SLANGTORCH_RECORD_MANIFEST'] = manifestFile
+        try:
+            # Relative paths are recorded as absolute paths. Repeated loads are recorded once.
+            compiler.recordModuleLoad('kernels/multiply.slang', {"defines": {"FACTOR": "2.0"}, "includePaths": ["include"]})
+            compiler.recordModuleLoad('kernels/multiply.slang', {"defines": {"FACTOR": "2.0"}, "includePaths": ["include"]})
+            compiler.recordModuleLoad('kernels/multiply.slang', {"defines": {"FACTOR": "3.0"}})
+
+            # Nothing is written until the loads are flushed (at exit).
+            assert(not os.path.exists(manifestFile))
+            compiler.flushRecordedLoads()
+            with open(manifestFile, 'r') as f:
+                modules = json.load(f)["modules"]
+            assert([m["defines"] for m in modules] == [{"FACTOR": "2.0"}, {"FACTOR": "3.0"}])
+            assert(all(m["fileName"] == os.path.abspath('kernels/multiply.slang') for m in modules))
+            assert(modules[0]["includePaths"] == [os.path.abspath('include')])
+
+            # Entries already in the manifest are not added again, and the manifest is left alone.
+            mtime = os.path.getmtime(manifestFile)
+            compiler._recordedLoads.clear()
+            compiler.recordModuleLoad('kernels/multiply.slang', {"defines": {"FACTOR": "3.0"}})
+            compiler.flushRecordedLoads()
+            assert(os.path.getmtime(manifestFile) == mtime)
+
+            entries = compiler.readWarmupManifest(manifestFile)
+            assert(len(entries) == 2 and entries[1]["fileName"] == os.path.abspath('kernels/multiply.slang'))
+        finally:
+            del os.environ['SLANGTORCH_RECORD_MANIFEST']
+
+
+class TestCooperativeBuild(unittest.TestCase):
+    def test_concurrent_processes_build_once(self):
+        test_dir = os.path.dirname(os.path.abspath(__file__))
+
+        # Get a temporary directory.
+        import tempfile
+        import shutil
+        import glob
+        import subprocess
+        tmpdir = tempfile.mkdtemp()
+
+        slangModuleFile = os.path.join(tmpdir, 'multiply.slang')
+        shutil.copy(os.path.join(test_dir, 'multiply.slang'), slangModuleFile)
+
+        # Several processes load the same module at once. One of them builds it, the others 
+        # wait and load its build.
+        script = ('import sys, torch, slangtorch; '
+                  'm = slangtorch.loadModule(sys.argv[1], defines={"FACTOR": "2.0"}); '
+                  'X = torch.tensor([[1., 2.], [3., 4.]]).cuda(); '
+                  'assert(torch.all(torch.eq(m.multiply(X).cpu(), (X * 2).cpu())))')
+        processes = [subprocess.Popen([sys.executable, '-c', script, slangModuleFile]) for _ in range(4)]
+        for process in processes:
+            assert(process.wait() == 0)
+
+        buildDirs = [d for d in glob.glob(os.path.join(tmpdir, '.slangtorch_cache', 'multiply', '*', '*')) 
+                     if os.path.isdir(d) and os.path.basename(d).isdigit()]
+        assert(len(buildDirs) == 1)
+
+
+class TestAsyncLoad(unittest.TestCase):
+    def test_load_modules_concurrently(self):
+        test_dir = os.path.dirname(os.path.abspath(__file__))
+        slangModuleFile = os.path.join(test_dir, 'multiply.slang')
+
+        # Two variants of the same file, and two threads building them.
+        futures = [slangtorch.loadModuleAsync(slangModuleFile, defines={'FACTOR': str(factor)}) 
+                   for factor in (2.0, 3.0)]
+
+        X = torch.tensor([[1., 2.], [3., 4.]]).cuda()
+        for factor, future in zip((2.0, 3.0), futures):
+            module = future.result()
+            assert(future.done())
+            assert(future.result() is module)
+
+            Y = module.multiply(X).cpu()
+            expected = (X * factor).cpu()
+            assert(torch.all(torch.eq(Y, expected)))
+
+
+class TestLoadModules(unittest.TestCase):
+    def test_load_modules(self):
+        test_dir = os.path.dirname(os.path.abspath(__file__))
+        multiplyFile = os.path.join(test_dir, 'multiply.slang')
+
+        modules = slangtorch.loadModules([
+            {'fileName': multiplyFile, 'defines': {'FACTOR': '2.0'}},
+            {'fileName': multiplyFile, 'defines': {'FACTOR': '4.0'}},
+            os.path.join(test_dir, 'smoke.slang')])
+        assert(len(modules) == 3)
+
+        X = torch.tensor([[1., 2.], [3., 4.]]).cuda()
+        for factor, module in zip((2.0, 4.0), modules[:2]):
+            Y = module.multiply(X).cpu()
+            expected = (X * factor).cpu()
+            assert(torch.all(torch.eq(Y, expected)))
+
+
+class TestObjectCache(unittest.TestCase):
+    def test_identical_sources_compile_once(self):
+        test_dir = os.path.dirname(os.path.abspath(__file__))
+
+        import tempfile
+        import shutil
+        objectCacheDir = tempfile.mkdtemp()
+        os.environ['SLANGTORCH_OBJECT_CACHE_DIR'] = objectCacheDir
+        try:
+            def countObjects():
+                return sum(1 for _, _, files in os.walk(objectCacheDir) for f in files if f.endswith('.o'))
+
+            modules = []
+            objectCounts = []
+            for _ in range(2):
+                # Same module in a fresh directory, under a different module name.
+                tmpdir = tempfile.mkdtemp()
+                slangModuleFile = os.path.join(tmpdir, 'multiply.slang')
+                shutil.copy(os.path.join(test_dir, 'multiply.slang'), slangModuleFile)
+                modules.append(slangtorch.loadModule(slangModuleFile, defines={'FACTOR': '2.0'}))
+                objectCounts.append(countObjects())
+
+            # Host source, module definition and CUDA source. Only the module definition depends
+            # on the module name, the other two are served from the cache.
+            assert(objectCounts[0] == 3)
+            assert(objectCounts[1] == 4)
+
+            X = torch.tensor([[1., 2.], [3., 4.]]).cuda()
+            for module in modules:
+                Y = module.multiply(X).cpu()
+                expected = torch.tensor([[2., 4.],[6., 8.]]).cpu()
+                assert(torch.all(torch.eq(Y, expected)))
+        finally:
+            del os.environ['SLANGTORCH_OBJECT_CACHE_DIR']
+
+
+    def test_option_matching(self):
+        from slangtorch.util import objcache
+
+        # Exact, '--option=value' and (for -D, -U, -I) attached values. Longer options that start 
+        # with a known one are not matched.
+        args = ['-include', 'a.h', '-include-pch', 'b.pch', '-DX=1', '-D', 'Y', '-I/inc', '-isystem', '/sys',
+                '-o', 'out.o', '-openmp', '-arch=sm_80', '-MF', 'out.d', '-MFextra']
+        matched, rest = objcache._splitOptions(args, objcache.PREPROCESSOR_OPTIONS + objcache.OUTPUT_OPTIONS)
+        assert(matched == ['-include', 'a.h', '-DX=1', '-D', 'Y', '-I/inc', '-isystem', '/sys', '-o', 'out.o', '-MF', 'out.d'])
+        assert(rest == ['-include-pch', 'b.pch', '-openmp', '-arch=sm_80', '-MFextra'])
+
+        matched, rest = objcache._splitOptions(['-arch=sm_80', '-gencode', 'arch=compute_80,code=sm_80', '-archive'], objcache.ARCH_OPTIONS)
+        assert(matched == ['-arch=sm_80', '-gencode', 'arch=compute_80,code=sm_80'])
+        assert(rest == ['-archive'])
+
+    def test_module_init_function_is_hidden(self):
+        import tempfile
+        from slangtorch.util import objcache
+        tmpdir = tempfile.mkdtemp()
+
+        hostSource = os.path.join(tmpdir, 'm.cpp')
+        with open(hostSource, 'w') as f:
+            f.write("int helper() { return 1; }\nPYBIND11_MODULE(TORCH_EXTENSION_NAME, m)\n{\n}\n")
+        sources = objcache.splitModuleDefinition([hostSource])
+
+        # Modules loaded into one process must not resolve each other's init function.
+        for source in sources:
+            with open(source, 'r') as f:
+                contents = f.read()
+            assert(objcache.MODULE_INIT_FUNCTION in contents)
+            if sys.platform != "win32":
+                assert(f'__attribute__((visibility("hidden"))) void {objcache.MODULE_INIT_FUNCTION}' in contents)
+
+    def test_clear_persistent_cache(self):
+        import tempfile
+        compiler = slangtorch.slangtorch
+        tmpdir = tempfile.mkdtemp()
+
+        # The object store and the toolchain cache in the user cache directory are cleared too.
+        objectCacheDir = os.path.join(tmpdir, 'objects')
+        os.makedirs(os.path.join(objectCacheDir, 'ab'))
+        toolchainCacheFile = os.path.join(tmpdir, 'toolchain.json')
+        with open(toolchainCacheFile, 'w') as f:
+            f.write('{}')
+
+        oldCacheFile = compiler.TOOLCHAIN_CACHE_FILE
+        compiler.TOOLCHAIN_CACHE_FILE = toolchainCacheFile
+        os.environ['SLANGTORCH_OBJECT_CACHE_DIR'] = objectCacheDir
+        try:
+            slangtorch.clearPersistentShaderCache()
+            assert(not os.path.exists(objectCacheDir))
+            assert(not os.path.exists(toolchainCacheFile))
+        finally:
+            compiler.TOOLCHAIN_CACHE_FILE = oldCacheFile
+            del os.environ['SLANGTORCH_OBJECT_CACHE_DIR']
+
+    def test_isolate_module_name(self):
+        import tempfile
+        from slangtorch.util import objcache
+        tmpdir = tempfile.mkdtemp()
+
+        # Only the module definition source is compiled with the module name define.
+        buildFile = os.path.join(tmpdir, 'build.ninja')
+        with open(buildFile, 'w') as f:
+            f.write("cflags = -DTORCH_EXTENSION_NAME=_slangtorch_m_1 -DTORCH_API_INCLUDE_EXTENSION_H -O3\n"
+                    "cuda_cflags = -DTORCH_EXTENSION_NAME=_slangtorch_m_1 -O3\n"
+                    "build m_slangtorch_host.o: compile /src/m_slangtorch_host.cpp\n"
+                    "build m_slangtorch_module.o: compile /src/m_slangtorch_module.cpp\n"
+                    "build m_cuda.cuda.o: cuda_compile /src/m_cuda.cu\n")
+        objcache.isolateModuleName(buildFile)
+
+        with open(buildFile, 'r') as f:
+            lines = f.read().splitlines()
+        assert(lines == [
+            "cflags = -DTORCH_API_INCLUDE_EXTENSION_H -O3",
+            "cuda_cflags = -O3",
+            "build m_slangtorch_host.o: compile /src/m_slangtorch_host.cpp",
+            "build m_slangtorch_module.o: compile /src/m_slangtorch_module.cpp",
+            "  cflags = $cflags -DTORCH_EXTENSION_NAME=_slangtorch_m_1",
+            "build m_cuda.cuda.o: cuda_compile /src/m_cuda.cu"])
+
+
 class TestCudaPreludeCache(unittest.TestCase):
     def test_cache_state_on_cuda_prelude_modification(self):
         test_dir = os.path.dirname(os.path.abspath(__file__))
@@ -253,6 +1400,42 @@ class TestCudaPreludeCache(unittest.TestCase):
         expected2 = torch.tensor([1.0]).cpu()
         assert(torch.all(torch.eq(X.cpu(), expected2)))
 
+    @unittest.skipIf(sys.platform == "win32", "Windows reloads the rebuilt binary in place")
+    def test_incremental_reload_on_cuda_prelude_modification(self):
+        test_dir = os.path.dirname(os.path.abspath(__file__))
+
+        cuPreludeTemplateTestFile = os.path.join(test_dir, 'cuda-intrinsic-test.cuh')
+        cuIntrinsicTestFile = os.path.join(test_dir, 'cuda-intrinsic-binding.slang')
+
+        import tempfile
+        import shutil
+        import glob
+        tmpdir = tempfile.mkdtemp()
+
+        cuPreludeFile = os.path.join(tmpdir, 'cuda-intrinsic-test.cuh')
+        cuIntrinsicFile = os.path.join(tmpdir, 'cuda-intrinsic-binding.slang')
+        shutil.copy(cuIntrinsicTestFile, tmpdir)
+
+        with open(cuPreludeTemplateTestFile, 'r') as f:
+            template = f.read()
+
+        for constVal in [2.0, 1.0, 3.0]:
+            with open(cuPreludeFile, 'w') as f:
+                f.write(template.replace(r'%CONST_VAL%', str(constVal)))
+
+            module = slangtorch.loadModule(cuIntrinsicFile)
+            X = torch.zeros((1,), dtype=torch.float, device='cuda:0')
+            module.getConst(output=X).launchRaw(blockSize=(1,1,1), gridSize=(1,1,1))
+            assert(torch.all(torch.eq(X.cpu(), torch.tensor([constVal]))))
+
+        # The edits were built incrementally in the first build directory, and loaded from copies
+        # of the binary.
+        #
+        buildDirs = [d for d in glob.glob(os.path.join(tmpdir, '.slangtorch_cache', 'cuda-intrinsic-binding', '*', '*'))
+                     if os.path.isdir(d) and os.path.basename(d).isdigit()]
+        assert(len(buildDirs) == 1)
+        assert(len(glob.glob(os.path.join(buildDirs[0], '*.r*.so'))) > 0)
+
 @contextmanager
 def suppressOutput():
     # Suppress stdout and stderr for the duration of the context manager.
@@ -353,6 +1536,143 @@ class TestAutoPyBind(unittest.TestCase):
 
         assert(torch.all(torch.eq(Y.cpu(), expected1)))
 
+class TestAutotune(unittest.TestCase):
+    def test_autotune_database_path(self):
+        import tempfile
+        compiler = slangtorch.slangtorch
+        tmpdir = tempfile.mkdtemp()
+
+        # The default database is in the user cache directory, not in the package.
+        oldAutotuneDb = os.environ.pop('SLANGTORCH_AUTOTUNE_DB', None)
+        oldCacheDir = os.environ.get('SLANGTORCH_CACHE_DIR')
+        os.environ['SLANGTORCH_CACHE_DIR'] = tmpdir
+        try:
+            assert(compiler.getAutotuneDatabasePath() == os.path.join(tmpdir, 'autotune.json'))
+        finally:
+            if oldCacheDir is None:
+                del os.environ['SLANGTORCH_CACHE_DIR']
+            else:
+                os.environ['SLANGTORCH_CACHE_DIR'] = oldCacheDir
+            if oldAutotuneDb is not None:
+                os.environ['SLANGTORCH_AUTOTUNE_DB'] = oldAutotuneDb
+
+    def test_autotune_database(self):
+        test_dir = os.path.dirname(os.path.abspath(__file__))
+        slangModuleFile = os.path.join(test_dir, 'multiply.slang')
+
+        import tempfile
+        import json
+        tmpdir = tempfile.mkdtemp()
+        database = os.path.join(tmpdir, 'autotune.json')
+
+        X = torch.tensor([[1., 2.], [3., 4.]]).cuda()
+        benchmarked = []
+        def benchmark(module, config):
+            benchmarked.append(config)
+            Y = module.multiply(X)
+            assert(torch.all(torch.eq(Y.cpu(), X.cpu() * float(config['FACTOR']))))
+
+        module, config = slangtorch.autotune(slangModuleFile, {'FACTOR': ['1.0', '2.0', '3.0']}, benchmark, database=database)
+        assert(config['FACTOR'] in ['1.0', '2.0', '3.0'])
+        assert(set(c['FACTOR'] for c in benchmarked) == set(['1.0', '2.0', '3.0']))
+
+        with open(database, 'r') as f:
+            entries = json.load(f)["entries"]
+        assert(len(entries) == 1)
+        assert(list(entries.values())[0]["config"] == config)
+
+        # The stored winner is used without benchmarking again.
+        benchmarked.clear()
+        module2, config2 = slangtorch.autotune(slangModuleFile, {'FACTOR': ['1.0', '2.0', '3.0']}, benchmark, database=database)
+        assert(config2 == config)
+        assert(len(benchmarked) == 0)
+        Y = module2.multiply(X).cpu()
+        assert(torch.all(torch.eq(Y, X.cpu() * float(config['FACTOR']))))
+
+class TestShapeSpecialization(unittest.TestCase):
+    def test_specialize_on_shapes(self):
+        import tempfile
+        import glob
+        import time
+        tmpdir = tempfile.mkdtemp()
+
+        # Reads the extent from the specialization defines where the build has them.
+        slangModuleFile = os.path.join(tmpdir, 'square.slang')
+        with open(slangModuleFile, 'w') as f:
+            f.write(
+                "[AutoPyBindCUDA]\n"
+                "[CUDAKernel]\n"
+                "void square(TensorView<float> input, TensorView<float> output)\n"
+                "{\n"
+                "    uint3 dispatchIdx = cudaThreadIdx() + cudaBlockIdx() * cudaBlockDim();\n"
+                "#ifdef SLANGTORCH_SHAPE_input_0\n"
+                "    uint size = SLANGTORCH_SHAPE_input_0;\n"
+                "#else\n"
+                "    uint size = input.size(0);\n"
+                "#endif\n"
+                "    if (dispatchIdx.x >= size)\n"
+                "        return;\n"
+                "    output[dispatchIdx.x] = input[dispatchIdx.x] * input[dispatchIdx.x];\n"
+                "}\n")
+
+        module = slangtorch.loadModule(slangModuleFile, specializeOnShapes=True)
+
+        X = torch.tensor([1., 2., 3., 4.]).cuda()
+        expected = torch.tensor([1., 4., 9., 16.]).cpu()
+
+        # The first call uses the generic build, and starts building the specialized one.
+        Y = torch.zeros_like(X).cuda()
+        module.square(input=X, output=Y).launchRaw(blockSize=(32, 1, 1), gridSize=(1, 1, 1))
+        assert(torch.all(torch.eq(Y.cpu(), expected)))
+
+        deadline = time.time() + 600
+        while len(glob.glob(os.path.join(tmpdir, '.slangtorch_cache', 'square', '*', 'published.json'))) < 2:
+            assert(time.time() < deadline)
+            time.sleep(0.5)
+
+        for _ in range(2):
+            Y = torch.zeros_like(X).cuda()
+            module.square(input=X, output=Y).launchRaw(blockSize=(32, 1, 1), gridSize=(1, 1, 1))
+            assert(torch.all(torch.eq(Y.cpu(), expected)))
+
+    def test_uses_shape_defines(self):
+        import tempfile
+        from slangtorch.slangtorch import usesShapeDefines
+        tmpdir = tempfile.mkdtemp()
+
+        # The defines are found through imports and includes.
+        with open(os.path.join(tmpdir, 'sizes.slang'), 'w') as f:
+            f.write("static const uint kSize = SLANGTORCH_SHAPE_input_0;\n")
+        with open(os.path.join(tmpdir, 'strides.h'), 'w') as f:
+            f.write("#define STRIDE SLANGTORCH_STRIDE_input_0\n")
+        with open(os.path.join(tmpdir, 'importer.slang'), 'w') as f:
+            f.write("import sizes;\n")
+        with open(os.path.join(tmpdir, 'includer.slang'), 'w') as f:
+            f.write('#include "strides.h"\n')
+        with open(os.path.join(tmpdir, 'generic.slang'), 'w') as f:
+            f.write("import importer_missing;\nvoid f() {}\n")
+
+        assert(usesShapeDefines(os.path.join(tmpdir, 'importer.slang')))
+        assert(usesShapeDefines(os.path.join(tmpdir, 'includer.slang')))
+        assert(not usesShapeDefines(os.path.join(tmpdir, 'generic.slang')))
+
+    def test_watch_is_rejected(self):
+        import tempfile
+        tmpdir = tempfile.mkdtemp()
+        slangModuleFile = os.path.join(tmpdir, 'square.slang')
+        with open(slangModuleFile, 'w') as f:
+            f.write("void f() {}\n")
+
+        with self.assertRaises(ValueError):
+            slangtorch.loadModule(slangModuleFile, specializeOnShapes=True, watch=True)
+
+        os.environ['SLANGTORCH_WATCH'] = '1'
+        try:
+            with self.assertRaises(ValueError):
+                slangtorch.loadModule(slangModuleFile, specializeOnShapes=True)
+        finally:
+            del os.environ['SLANGTORCH_WATCH']
+
 class TestAutoPyBindDiff(unittest.TestCase):
     def setUp(self) -> None:
         test_dir = os.path.dirname(os.path.abspath(__file__))